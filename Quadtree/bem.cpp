@@ -0,0 +1,257 @@
+#include "bem.h"
+#include "fmm.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+namespace {
+typedef std::function<void(std::vector<double> const&, std::vector<double>&)> Linear_map;
+
+bool fail(std::string* error, std::string const& message) {
+	if (error != nullptr) {
+		*error = message;
+	}
+	return false;
+}
+
+double norm(std::vector<double> const& v) {
+	double sum = 0;
+	for (double x : v) {
+		sum += x * x;
+	}
+	return sqrt(sum);
+}
+
+// integral of 1/|c - y| over the triangle, c in its plane and inside it:
+// the triangle is cut into three with apex c, each gives
+// h (asinh(s_b / h) - asinh(s_a / h)) for an edge ab at distance h from c
+// and s the positions of a and b along the edge from the foot of c
+double self_integral(Triangle const& t, Point c) {
+	double sum = 0;
+	for (int e = 0; e < 3; e++) {
+		Point a = t.points[e];
+		Point b = t.points[(e + 1) % 3];
+		Point edge = b - a;
+		double length = sqrt(static_cast<double>(dot_product(edge, edge)));
+		if (length == 0) {
+			continue;
+		}
+		Point u = edge / static_cast<float>(length);
+		double s_a = dot_product(a - c, u);
+		double s_b = dot_product(b - c, u);
+		Point foot = a - c - u * static_cast<float>(s_a);
+		double h = sqrt(static_cast<double>(dot_product(foot, foot)));
+		if (h > 0) {
+			sum += h * (asinh(s_b / h) - asinh(s_a / h));
+		}
+	}
+	return sum;
+}
+
+// Restarted GMRES, modified Gram-Schmidt with Givens rotations. Starts
+// from zero and stops once |b - A x| <= tolerance |b|.
+bool gmres(Linear_map const& apply, std::vector<double> const& b, std::vector<double>& x, int restart,
+	int max_iterations, double tolerance, int& iterations, double& residual) {
+	size_t n = b.size();
+	x.assign(n, 0);
+	iterations = 0;
+	residual = 0;
+	double b_norm = norm(b);
+	if (b_norm == 0) {
+		return true;
+	}
+	std::vector<std::vector<double> > v(restart + 1, std::vector<double>(n));
+	std::vector<std::vector<double> > h(restart + 1, std::vector<double>(restart));
+	std::vector<double> cs(restart);
+	std::vector<double> sn(restart);
+	std::vector<double> g(restart + 1);
+	std::vector<double> w(n);
+	while (true) {
+		apply(x, w);
+		for (size_t i = 0; i < n; i++) {
+			w[i] = b[i] - w[i];
+		}
+		double beta = norm(w);
+		residual = beta / b_norm;
+		if (residual <= tolerance) {
+			return true;
+		}
+		if (iterations >= max_iterations) {
+			return false;
+		}
+		for (size_t i = 0; i < n; i++) {
+			v[0][i] = w[i] / beta;
+		}
+		std::fill(g.begin(), g.end(), 0);
+		g[0] = beta;
+		int k = 0;
+		while (k < restart && iterations < max_iterations) {
+			apply(v[k], w);
+			iterations++;
+			for (int j = 0; j <= k; j++) {
+				double dot = 0;
+				for (size_t i = 0; i < n; i++) {
+					dot += w[i] * v[j][i];
+				}
+				h[j][k] = dot;
+				for (size_t i = 0; i < n; i++) {
+					w[i] -= dot * v[j][i];
+				}
+			}
+			double next = norm(w);
+			h[k + 1][k] = next;
+			if (next != 0) {
+				for (size_t i = 0; i < n; i++) {
+					v[k + 1][i] = w[i] / next;
+				}
+			}
+			for (int j = 0; j < k; j++) {
+				double top = cs[j] * h[j][k] + sn[j] * h[j + 1][k];
+				h[j + 1][k] = -sn[j] * h[j][k] + cs[j] * h[j + 1][k];
+				h[j][k] = top;
+			}
+			double length = hypot(h[k][k], h[k + 1][k]);
+			cs[k] = h[k][k] / length;
+			sn[k] = h[k + 1][k] / length;
+			h[k][k] = length;
+			h[k + 1][k] = 0;
+			g[k + 1] = -sn[k] * g[k];
+			g[k] = cs[k] * g[k];
+			k++;
+			// next == 0 means the Krylov space holds the solution
+			if (fabs(g[k]) <= tolerance * b_norm || next == 0) {
+				break;
+			}
+		}
+		// back substitution for the k coefficients of the Krylov vectors
+		std::vector<double> y(k);
+		for (int j = k - 1; j >= 0; j--) {
+			double sum = g[j];
+			for (int l = j + 1; l < k; l++) {
+				sum -= h[j][l] * y[l];
+			}
+			y[j] = sum / h[j][j];
+		}
+		for (int j = 0; j < k; j++) {
+			for (size_t i = 0; i < n; i++) {
+				x[i] += y[j] * v[j][i];
+			}
+		}
+	}
+}
+
+template <int P>
+bool solve(Scene& scene, Bem_settings const& settings, Bem_result* result, std::string* error) {
+	// triangles with an area, the others keep no charge
+	std::vector<Point> centroids;
+	std::vector<double> self;
+	std::vector<int> owner;
+	std::vector<std::vector<int> > index(scene.size());
+	for (size_t k = 0; k < scene.size(); k++) {
+		PObject const& object = scene.get(static_cast<Object_handle>(k));
+		index[k].assign(object.size(), -1);
+		for (size_t i = 0; i < object.size(); i++) {
+			Triangle t = object.triangle(i);
+			Point normal = cross_product(t.points[1] - t.points[0], t.points[2] - t.points[0]);
+			double area = sqrt(static_cast<double>(dot_product(normal, normal))) / 2;
+			if (area == 0) {
+				continue;
+			}
+			Point c = (t.points[0] + t.points[1] + t.points[2]) / 3;
+			index[k][i] = static_cast<int>(centroids.size());
+			centroids.push_back(c);
+			self.push_back(self_integral(t, c) / area);
+			owner.push_back(static_cast<int>(k));
+		}
+	}
+	size_t n = centroids.size();
+	size_t count = scene.size();
+
+	// The unknowns are u = self * charge for every triangle, so the
+	// diagonal of the potential rows is one, and the potential of every
+	// object. The charge rows are divided by the sum of 1 / self over the
+	// object, they then read as a weighted mean of u.
+	std::vector<double> scale(count);
+	for (size_t i = 0; i < n; i++) {
+		scale[owner[i]] += 1 / self[i];
+	}
+	std::vector<double> b(n + count);
+	for (size_t k = 0; k < count; k++) {
+		if (scale[k] == 0) {
+			return fail(error, "object " + std::to_string(k) + " has no surface to hold a charge");
+		}
+		scale[k] = 1 / scale[k];
+		b[n + k] = scale[k] * scene.get(static_cast<Object_handle>(k)).get_charge();
+	}
+
+	Point_fmm<P> fmm(centroids, settings.theta);
+	std::vector<double> charges(n);
+	std::vector<double> potential;
+	Linear_map apply = [&](std::vector<double> const& x, std::vector<double>& y) {
+		for (size_t i = 0; i < n; i++) {
+			charges[i] = x[i] / self[i];
+		}
+		fmm.potential(charges, potential);
+		std::fill(y.begin() + n, y.end(), 0);
+		for (size_t i = 0; i < n; i++) {
+			y[i] = x[i] + potential[i] - x[n + owner[i]];
+			y[n + owner[i]] += scale[owner[i]] * charges[i];
+		}
+	};
+
+	std::vector<double> x;
+	int iterations;
+	double residual;
+	bool ok = gmres(apply, b, x, settings.restart, settings.max_iterations, settings.tolerance, iterations,
+		residual);
+	if (result != nullptr) {
+		result->iterations = iterations;
+		result->residual = residual;
+		result->potentials.assign(count, 0);
+		for (size_t k = 0; k < count; k++) {
+			result->potentials[k] = static_cast<float>(x[n + k]);
+		}
+	}
+	if (!ok) {
+		return fail(error, "GMRES stopped after " + std::to_string(iterations) + " iterations at residual " +
+			std::to_string(residual));
+	}
+	for (size_t k = 0; k < count; k++) {
+		std::vector<float> surface(index[k].size());
+		for (size_t i = 0; i < surface.size(); i++) {
+			int id = index[k][i];
+			if (id >= 0) {
+				surface[i] = static_cast<float>(x[id] / self[id]);
+			}
+		}
+		scene.set_surface_charges(static_cast<Object_handle>(k), std::move(surface));
+	}
+	return true;
+}
+}
+
+Bem_settings::Bem_settings() :
+	theta(0.5f),
+	order(4),
+	tolerance(1e-5),
+	restart(50),
+	max_iterations(500) { }
+
+bool solve_surface_charges(Scene& scene, Bem_settings const& settings, Bem_result* result, std::string* error) {
+	if (settings.restart < 1 || settings.max_iterations < 1) {
+		return fail(error, "GMRES needs a positive restart and iteration limit");
+	}
+	switch (settings.order) {
+	case 2:
+		return solve<2>(scene, settings, result, error);
+	case 4:
+		return solve<4>(scene, settings, result, error);
+	case 6:
+		return solve<6>(scene, settings, result, error);
+	case 8:
+		return solve<8>(scene, settings, result, error);
+	default:
+		return fail(error, "FMM order " + std::to_string(settings.order) + " is not one of 2, 4, 6, 8");
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "scene.h"
+
+struct Bem_settings {
+	Bem_settings();
+
+	float theta;        // opening criterion of the FMM products
+	int order;          // expansion order of the FMM products: 2, 4, 6 or 8
+	double tolerance;   // wanted GMRES residual relative to the right-hand side
+	int restart;        // Krylov vectors kept before GMRES starts over
+	int max_iterations;
+};
+
+struct Bem_result {
+	int iterations;
+	double residual;                 // relative, as compared with tolerance
+	std::vector<float> potentials;   // the potential of every object
+};
+
+// Spreads the charge of every object of scene over its surface so that
+// each object is an equipotential conductor holding its charge, and stores
+// the charge of every triangle in the object (PObject::set_surface_charges).
+// Build the trees on the scene afterwards.
+//
+// Collocation at the triangle centroids with a constant density per
+// triangle: the unknowns are the triangle charges and one potential per
+// object, the equations ask for that potential at every centroid of the
+// object and for the charges of the object to add up to its charge. A
+// triangle sees itself through the exact integral of 1/r over it and the
+// others as point charges at their centroids, summed by Point_fmm. GMRES,
+// scaled by the self terms, solves the system.
+//
+// On failure returns false, leaves the scene as it was and describes the
+// problem in error.
+bool solve_surface_charges(Scene& scene, Bem_settings const& settings = Bem_settings(),
+	Bem_result* result = nullptr, std::string* error = nullptr);
@@ -0,0 +1,239 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	const int LEAF_SIZE = 4;
+	const double EDGE_EPS = 1e-9;
+
+	// not parallel to any axis or to the faces of grid aligned meshes
+	const Point RAY_DIRECTIONS[] = {
+		Point(0.5773503f, 0.6172134f, 0.5345225f),
+		Point(-0.3713907f, 0.7427814f, -0.5570860f),
+		Point(0.8017837f, -0.2672612f, 0.5345225f),
+		Point(-0.6546537f, -0.4364358f, -0.6172134f)
+	};
+
+	Box triangle_bounds(Triangle const& t) {
+		Box result(t.points[0], t.points[0]);
+		for (int i = 1; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				result.first[j] = fminf(result.first[j], t.points[i][j]);
+				result.second[j] = fmaxf(result.second[j], t.points[i][j]);
+			}
+		}
+		return result;
+	}
+
+	void extend(Box& box, Box const& other) {
+		for (int j = 0; j < 3; j++) {
+			box.first[j] = fminf(box.first[j], other.first[j]);
+			box.second[j] = fmaxf(box.second[j], other.second[j]);
+		}
+	}
+
+	bool touches(Box const& a, Box const& b) {
+		for (int j = 0; j < 3; j++) {
+			if (a.second[j] < b.first[j] || b.second[j] < a.first[j]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool ray_hits_box(Box const& box, Point origin, Point inv_dir) {
+		double low = 0;
+		double high = INFINITY;
+		for (int j = 0; j < 3; j++) {
+			double t1 = (static_cast<double>(box.first[j]) - origin[j]) * inv_dir[j];
+			double t2 = (static_cast<double>(box.second[j]) - origin[j]) * inv_dir[j];
+			low = std::max(low, std::min(t1, t2));
+			high = std::min(high, std::max(t1, t2));
+		}
+		return low <= high;
+	}
+
+	// Moller-Trumbore in double precision. Returns 1 for a clean crossing,
+	// -1 if the ray passes too close to an edge or starts on the triangle.
+	int ray_triangle(Triangle const& t, Point origin, Point dir) {
+		double a[3], e1[3], e2[3], d[3], s[3];
+		for (int j = 0; j < 3; j++) {
+			a[j] = t.points[0][j];
+			e1[j] = static_cast<double>(t.points[1][j]) - a[j];
+			e2[j] = static_cast<double>(t.points[2][j]) - a[j];
+			d[j] = dir[j];
+			s[j] = static_cast<double>(origin[j]) - a[j];
+		}
+		double p[3] = {
+			d[1] * e2[2] - d[2] * e2[1],
+			d[2] * e2[0] - d[0] * e2[2],
+			d[0] * e2[1] - d[1] * e2[0]
+		};
+		double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (det == 0) {
+			// the ray is parallel to the triangle, it is only a problem inside its plane
+			double n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0]
+			};
+			return s[0] * n[0] + s[1] * n[1] + s[2] * n[2] == 0 ? -1 : 0;
+		}
+		double u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+		double q[3] = {
+			s[1] * e1[2] - s[2] * e1[1],
+			s[2] * e1[0] - s[0] * e1[2],
+			s[0] * e1[1] - s[1] * e1[0]
+		};
+		double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+		double dist = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+		if (u < -EDGE_EPS || v < -EDGE_EPS || u + v > 1 + EDGE_EPS || dist < -EDGE_EPS) {
+			return 0;
+		}
+		if (u < EDGE_EPS || v < EDGE_EPS || u + v > 1 - EDGE_EPS || dist < EDGE_EPS) {
+			return -1;
+		}
+		return 1;
+	}
+}
+
+Box_bvh::Box_bvh() { }
+
+Box_bvh::Box_bvh(std::vector<Box> const& boxes) {
+	std::vector<Point> centres;
+	centres.reserve(boxes.size());
+	for (Box const& box : boxes) {
+		centres.push_back((box.first + box.second) / 2);
+	}
+	build(boxes, centres);
+}
+
+void Box_bvh::build(std::vector<Box> const& boxes, std::vector<Point> const& centres) {
+	order.resize(boxes.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = static_cast<int>(i);
+	}
+	if (!order.empty()) {
+		nodes.reserve(2 * order.size() / LEAF_SIZE + 1);
+		build(boxes, centres, 0, static_cast<int>(order.size()));
+	}
+}
+
+Triangle_bvh::Triangle_bvh() { }
+
+Triangle_bvh::Triangle_bvh(Indexed_mesh const& mesh) {
+	// boxes and centres are gathered once, the build only reads them
+	std::vector<Box> boxes;
+	std::vector<Point> centres;
+	boxes.reserve(mesh.size());
+	centres.reserve(mesh.size());
+	for (size_t i = 0; i < mesh.size(); i++) {
+		Triangle t = mesh.triangle(i);
+		boxes.push_back(triangle_bounds(t));
+		centres.push_back((t.points[0] + t.points[1] + t.points[2]) / 3);
+	}
+	build(boxes, centres);
+}
+
+int Box_bvh::build(std::vector<Box> const& boxes, std::vector<Point> const& centres, int first, int last) {
+	int id = static_cast<int>(nodes.size());
+	nodes.push_back(node());
+	Box bounds = boxes[order[first]];
+	Box centre_bounds(centres[order[first]], centres[order[first]]);
+	for (int i = first + 1; i < last; i++) {
+		extend(bounds, boxes[order[i]]);
+		extend(centre_bounds, Box(centres[order[i]], centres[order[i]]));
+	}
+	nodes[id].bounds = bounds;
+	if (last - first <= LEAF_SIZE) {
+		nodes[id].first = first;
+		nodes[id].count = last - first;
+		nodes[id].right = -1;
+		return id;
+	}
+
+	Point size = centre_bounds.second - centre_bounds.first;
+	int axis = 0;
+	for (int j = 1; j < 3; j++) {
+		if (size[j] > size[axis]) {
+			axis = j;
+		}
+	}
+	int mid = (first + last) / 2;
+	std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last, [&](int a, int b) {
+		return centres[a][axis] < centres[b][axis];
+	});
+	nodes[id].first = first;
+	nodes[id].count = 0;
+	build(boxes, centres, first, mid);
+	int right = build(boxes, centres, mid, last);
+	nodes[id].right = right;
+	return id;
+}
+
+int Triangle_bvh::count_crossings(Indexed_mesh const& mesh, Point origin, Point dir, bool& degenerate) const {
+	Point inv_dir(1 / dir.x, 1 / dir.y, 1 / dir.z);
+	int crossings = 0;
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		node const& cur = nodes[stack[--top]];
+		if (!ray_hits_box(cur.bounds, origin, inv_dir)) {
+			continue;
+		}
+		if (cur.count == 0) {
+			stack[top++] = cur.right;
+			stack[top++] = static_cast<int>(&cur - nodes.data()) + 1;
+			continue;
+		}
+		for (int i = cur.first; i < cur.first + cur.count; i++) {
+			int hit = ray_triangle(mesh.triangle(order[i]), origin, dir);
+			if (hit < 0) {
+				degenerate = true;
+				return 0;
+			}
+			crossings += hit;
+		}
+	}
+	return crossings;
+}
+
+bool Triangle_bvh::contains(Indexed_mesh const& mesh, Point p) const {
+	if (nodes.empty() || !nodes[0].bounds.contains(p)) {
+		return false;
+	}
+	for (Point dir : RAY_DIRECTIONS) {
+		bool degenerate = false;
+		int crossings = count_crossings(mesh, p, dir, degenerate);
+		if (!degenerate) {
+			return crossings % 2 == 1;
+		}
+	}
+	// every ray grazed the surface, so p lies on it
+	return true;
+}
+
+void Box_bvh::query(Box limit, std::vector<int>& result) const {
+	if (nodes.empty()) {
+		return;
+	}
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int id = stack[--top];
+		node const& cur = nodes[id];
+		if (!touches(cur.bounds, limit)) {
+			continue;
+		}
+		if (cur.count == 0) {
+			stack[top++] = cur.right;
+			stack[top++] = id + 1;
+			continue;
+		}
+		for (int i = cur.first; i < cur.first + cur.count; i++) {
+			result.push_back(order[i]);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+
+// Bounding volume hierarchy over a list of boxes, split at the median
+// centre along the longest axis. It stores only indices into the list.
+class Box_bvh {
+protected:
+	struct node {
+		Box bounds;
+		int first;  // first index in order for a leaf
+		int count;  // 0 for an inner node
+		int right;  // the left child directly follows its parent
+	};
+
+	std::vector<node> nodes;
+	std::vector<int> order;
+
+	void build(std::vector<Box> const& boxes, std::vector<Point> const& centres);
+	int build(std::vector<Box> const& boxes, std::vector<Point> const& centres, int first, int last);
+
+public:
+	Box_bvh();
+	explicit Box_bvh(std::vector<Box> const& boxes);
+
+	// indices of the boxes that touch limit
+	void query(Box limit, std::vector<int>& result) const;
+};
+
+// The hierarchy over the triangles of one mesh. The mesh itself is passed
+// to every query so the owner can be copied freely.
+class Triangle_bvh : public Box_bvh {
+	int count_crossings(Indexed_mesh const& mesh, Point origin, Point dir, bool& degenerate) const;
+
+public:
+	Triangle_bvh();
+	explicit Triangle_bvh(Indexed_mesh const& mesh);
+
+	// ray parity test, retried along other directions when a ray grazes
+	// an edge or a vertex, so it needs neither a volume nor an eps
+	bool contains(Indexed_mesh const& mesh, Point p) const;
+};
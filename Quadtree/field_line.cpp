@@ -0,0 +1,163 @@
+#include "field_line.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	const float MIN_FIELD = 1e-12f;
+
+	// Dormand-Prince 5(4) tableau, the 7th stage is evaluated at the new point (FSAL)
+	const float A[7][6] = {
+		{ 0 },
+		{ 1.f / 5 },
+		{ 3.f / 40, 9.f / 40 },
+		{ 44.f / 45, -56.f / 15, 32.f / 9 },
+		{ 19372.f / 6561, -25360.f / 2187, 64448.f / 6561, -212.f / 729 },
+		{ 9017.f / 3168, -355.f / 33, 46732.f / 5247, 49.f / 176, -5103.f / 18656 },
+		{ 35.f / 384, 0, 500.f / 1113, 125.f / 192, -2187.f / 6784, 11.f / 84 }
+	};
+	// difference between the 5th and the embedded 4th order weights
+	const float E[7] = {
+		71.f / 57600, 0, -71.f / 16695, 71.f / 1920, -17253.f / 339200, 22.f / 525, -1.f / 40
+	};
+
+	struct Line_state {
+		int line;
+		Point p;
+		float h;
+		float length;
+		int steps;
+	};
+
+	float norm(Point p) {
+		return sqrtf(dot_product(p, p));
+	}
+}
+
+Trace_settings::Trace_settings() :
+	tolerance(1e-4f),
+	initial_step(1e-2f),
+	min_step(1e-5f),
+	max_step(1.f),
+	max_length(100.f),
+	max_steps(100000),
+	direction(1),
+	batch_size(4096) { }
+
+Field_line_tracer::Field_line_tracer(Physical_quadtree const& tree, Trace_settings const& settings) :
+	tree(tree),
+	settings(settings) { }
+
+void Field_line_tracer::direction_at(std::vector<Point> const& points, std::vector<Point>& result) const {
+	tree.field_at(points, result);
+	for (auto& v : result) {
+		float len = norm(v);
+		v = len < MIN_FIELD ? Point() : v * (settings.direction / len);
+	}
+}
+
+void Field_line_tracer::trace_batch(std::vector<Point> const& seeds, std::vector<Field_line>& lines) const {
+	Box limit = tree.get_limit();
+	std::vector<Line_state> active;
+	for (size_t i = 0; i < seeds.size(); i++) {
+		lines[i].points.push_back(seeds[i]);
+		if (!limit.contains(seeds[i])) {
+			lines[i].reason = LEFT_LIMIT;
+		}
+		else if (tree.is_full_point(seeds[i])) {
+			lines[i].reason = HIT_OBJECT;
+		}
+		else {
+			active.push_back({ static_cast<int>(i), seeds[i], settings.initial_step, 0, 0 });
+		}
+	}
+
+	std::vector<Point> stage_points;
+	std::vector<Point> k[7];
+	stage_points.reserve(active.size());
+	for (auto v : active) {
+		stage_points.push_back(v.p);
+	}
+	direction_at(stage_points, k[0]);
+
+	while (!active.empty()) {
+		size_t n = active.size();
+		for (int s = 1; s < 7; s++) {
+			stage_points.resize(n);
+			for (size_t i = 0; i < n; i++) {
+				Point delta;
+				for (int j = 0; j < s; j++) {
+					delta = delta + k[j][i] * A[s][j];
+				}
+				stage_points[i] = active[i].p + delta * active[i].h;
+			}
+			direction_at(stage_points, k[s]);
+		}
+
+		// stage_points now holds the 5th order solution and k[6] its direction
+		std::vector<Line_state> next;
+		std::vector<Point> next_k;
+		for (size_t i = 0; i < n; i++) {
+			Line_state cur = active[i];
+			Field_line& line = lines[cur.line];
+			if (norm(k[0][i]) == 0) {
+				line.reason = ZERO_FIELD;
+				continue;
+			}
+			Point error;
+			for (int j = 0; j < 7; j++) {
+				error = error + k[j][i] * E[j];
+			}
+			float err = norm(error) * cur.h;
+			float factor = err == 0 ? 5.f : 0.9f * powf(settings.tolerance / err, 0.2f);
+			factor = std::min(5.f, std::max(0.2f, factor));
+
+			if (err > settings.tolerance && cur.h > settings.min_step) {
+				cur.h = std::max(settings.min_step, cur.h * factor);
+				next.push_back(cur);
+				next_k.push_back(k[0][i]);
+				continue;
+			}
+
+			cur.p = stage_points[i];
+			cur.length += cur.h;
+			cur.steps++;
+			cur.h = std::min(settings.max_step, std::max(settings.min_step, cur.h * factor));
+			line.points.push_back(cur.p);
+			if (!limit.contains(cur.p)) {
+				line.reason = LEFT_LIMIT;
+			}
+			else if (tree.is_full_point(cur.p)) {
+				line.reason = HIT_OBJECT;
+			}
+			else if (cur.length >= settings.max_length) {
+				line.reason = MAX_LENGTH;
+			}
+			else if (cur.steps >= settings.max_steps) {
+				line.reason = MAX_STEPS;
+			}
+			else {
+				next.push_back(cur);
+				next_k.push_back(k[6][i]);
+			}
+		}
+		active.swap(next);
+		k[0].swap(next_k);
+	}
+}
+
+std::vector<Field_line> Field_line_tracer::trace(std::vector<Point> const& seeds) const {
+	std::vector<Field_line> lines(seeds.size());
+	size_t batch = std::max(1, settings.batch_size);
+	for (size_t first = 0; first < seeds.size(); first += batch) {
+		size_t last = std::min(seeds.size(), first + batch);
+		std::vector<Point> part(seeds.begin() + first, seeds.begin() + last);
+		std::vector<Field_line> result(part.size());
+		trace_batch(part, result);
+		std::move(result.begin(), result.end(), lines.begin() + first);
+	}
+	return lines;
+}
+
+Field_line Field_line_tracer::trace(Point seed) const {
+	return trace(std::vector<Point>(1, seed))[0];
+}
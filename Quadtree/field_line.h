@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "physical_quadtree.h"
+
+enum StopReason {
+	LEFT_LIMIT,
+	HIT_OBJECT,
+	ZERO_FIELD,
+	MAX_LENGTH,
+	MAX_STEPS
+};
+
+struct Field_line {
+	std::vector<Point> points;
+	StopReason reason;
+};
+
+struct Trace_settings {
+	Trace_settings();
+
+	float tolerance;    // allowed local error of one step
+	float initial_step;
+	float min_step;
+	float max_step;
+	float max_length;
+	int max_steps;
+	int direction;      // 1 follows E, -1 goes against it
+	int batch_size;     // seeds integrated together with shared tree walks
+};
+
+// Integrates dp/ds = E / |E| with adaptive Dormand-Prince 5(4) steps.
+// A line stops when it leaves the tree's limit or reaches a FULL_NODE.
+class Field_line_tracer {
+	Physical_quadtree const& tree;
+	Trace_settings settings;
+
+	void direction_at(std::vector<Point> const& points, std::vector<Point>& result) const;
+	void trace_batch(std::vector<Point> const& seeds, std::vector<Field_line>& lines) const;
+
+public:
+	Field_line_tracer(Physical_quadtree const& tree, Trace_settings const& settings = Trace_settings());
+
+	std::vector<Field_line> trace(std::vector<Point> const& seeds) const;
+	Field_line trace(Point seed) const;
+};
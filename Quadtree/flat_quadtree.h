@@ -0,0 +1,400 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "geometry.h"
+#include "mapped_file.h"
+#include "quadtree.h"
+
+// Read-only copy of a built Quadtree for point queries. The nodes sit in
+// one array in depth-first order: a left child directly follows its
+// parent and only the index of the right child is stored. Node boxes are
+// not stored, the split plane is recomputed from the depth while walking
+// down, exactly as divide_box does. Payloads live in a parallel array so
+// the walk itself only touches 8 bytes per level.
+//
+// The arrays are also the snapshot file format: save() writes them behind
+// a versioned header and load() maps the file and answers queries from
+// the mapped pages, nothing is copied at startup. load() only reads the
+// 8 byte node records once, to turn down a file whose walk could leave
+// the array or go back up the tree.
+template <class T>
+class Flat_quadtree {
+public:
+	enum {
+		HAS_LEFT = 1,
+		HAS_RIGHT = 2
+	};
+
+	struct flat_node {
+		uint32_t right;
+		uint8_t type;
+		uint8_t children;
+		uint16_t unused;
+	};
+
+	// bumped whenever the layout of the file changes
+	static const uint32_t SNAPSHOT_VERSION = 2;
+
+private:
+	typedef typename Quadtree<T>::node tree_node;
+
+	struct snapshot_header {
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order;
+		uint32_t payload_size;
+		uint32_t payload_align;
+		uint64_t node_count;
+		uint64_t zone_count;
+		uint64_t nodes_offset;
+		uint64_t data_offset;
+		uint64_t zones_offset;
+		float limit[6];
+		uint32_t unused;
+		uint64_t key;
+	};
+
+	// filled when built from a tree, empty when the arrays are mapped
+	std::vector<flat_node> own_nodes;
+	std::vector<T> own_data;
+	std::vector<float> own_zones;
+	std::unique_ptr<Mapped_file> file;
+
+	flat_node const* nodes;
+	T const* data;
+	float const* zones;  // first and second corner of every zone
+	size_t count;
+	size_t zone_count;
+	Box limit;
+	uint64_t key;
+
+	Flat_quadtree();
+	void add(tree_node const* cur);
+	static bool is_empty(tree_node const* cur);
+	void attach();
+	int get(Point p) const;
+
+	static size_t align(size_t offset, size_t alignment);
+	// a child after its parent and the flags telling which are there
+	static bool is_valid(flat_node const* nodes, size_t count);
+
+public:
+	explicit Flat_quadtree(Quadtree<T> const& tree);
+	Flat_quadtree(Flat_quadtree&&) = default;
+	Flat_quadtree(Flat_quadtree const&) = delete;
+	Flat_quadtree& operator=(Flat_quadtree const&) = delete;
+
+	bool is_empty_point(Point p) const;
+	bool is_full_point(Point p) const;
+	T get_data(Point p) const;
+
+	Box get_limit() const;
+	std::vector<Box> get_zones() const;
+	size_t size() const;
+
+	// what the tree was built from as the caller hashes it, 0 unless set;
+	// a snapshot keeps it so a loader can tell whether it still fits
+	void set_key(uint64_t key);
+	uint64_t get_key() const;
+
+	// T is written byte for byte, so it has to be trivially copyable and
+	// a snapshot is only read back on a machine of the same byte order
+	bool save(std::string const& path, std::string* error = nullptr) const;
+	static std::unique_ptr<Flat_quadtree> load(std::string const& path, std::string* error = nullptr);
+};
+
+template <class T>
+Flat_quadtree<T>::Flat_quadtree() :
+	nodes(nullptr),
+	data(nullptr),
+	zones(nullptr),
+	count(0),
+	zone_count(0),
+	key(0) { }
+
+template <class T>
+Flat_quadtree<T>::Flat_quadtree(Quadtree<T> const& tree) :
+	Flat_quadtree() {
+	limit = tree.get_limit();
+	// get_zones makes a lazy tree completely before it is copied
+	std::vector<Box> tree_zones = tree.get_zones();
+	add(tree.root);
+	for (Box const& zone : tree_zones) {
+		for (int j = 0; j < 3; j++) {
+			own_zones.push_back(zone.first[j]);
+		}
+		for (int j = 0; j < 3; j++) {
+			own_zones.push_back(zone.second[j]);
+		}
+	}
+	attach();
+}
+
+template <class T>
+void Flat_quadtree<T>::add(tree_node const* cur) {
+	// a lazy tree keeps the nodes that split into nothing, they are
+	// dropped like an eager build drops them
+	if (is_empty(cur)) {
+		return;
+	}
+	size_t id = own_nodes.size();
+	flat_node v;
+	v.right = 0;
+	v.type = static_cast<uint8_t>(cur->type);
+	v.children = (is_empty(cur->children[0]) ? 0 : HAS_LEFT) | (is_empty(cur->children[1]) ? 0 : HAS_RIGHT);
+	v.unused = 0;
+	own_nodes.push_back(v);
+	own_data.push_back(cur->data);
+	add(cur->children[0]);
+	own_nodes[id].right = static_cast<uint32_t>(own_nodes.size());
+	add(cur->children[1]);
+}
+
+template <class T>
+bool Flat_quadtree<T>::is_empty(tree_node const* cur) {
+	return cur == nullptr || cur->type == EMPTY_NODE;
+}
+
+template <class T>
+void Flat_quadtree<T>::attach() {
+	nodes = own_nodes.data();
+	data = own_data.data();
+	zones = own_zones.data();
+	count = own_nodes.size();
+	zone_count = own_zones.size() / 6;
+}
+
+// index of the node the scalar Quadtree::get would stop at, -1 for none
+template <class T>
+int Flat_quadtree<T>::get(Point p) const {
+	if (count == 0 || !limit.contains(p)) {
+		return -1;
+	}
+	Point low = limit.first;
+	Point high = limit.second;
+	uint32_t cur = 0;
+	for (int height = 0; ; height++) {
+		flat_node const& v = nodes[cur];
+		if (v.type != NO_EMPTY_NODE) {
+			return static_cast<int>(cur);
+		}
+		int d = height % 3;
+		float s = (low[d] + high[d]) / 2;
+		if (p[d] >= s) {
+			if (!(v.children & HAS_LEFT)) {
+				return -1;
+			}
+			low[d] = s;
+			cur++;
+		}
+		else {
+			if (!(v.children & HAS_RIGHT)) {
+				return -1;
+			}
+			high[d] = s;
+			// a child follows its parent in the array, a right index that
+			// does not is from a damaged snapshot and would walk in circles
+			if (v.right <= cur) {
+				return -1;
+			}
+			cur = v.right;
+		}
+		// a damaged snapshot must not send the walk out of the array
+		if (cur >= count) {
+			return -1;
+		}
+	}
+}
+
+template <class T>
+bool Flat_quadtree<T>::is_empty_point(Point p) const {
+	return get(p) < 0;
+}
+
+template <class T>
+bool Flat_quadtree<T>::is_full_point(Point p) const {
+	int id = get(p);
+	return id >= 0 && nodes[id].type == FULL_NODE;
+}
+
+template <class T>
+T Flat_quadtree<T>::get_data(Point p) const {
+	int id = get(p);
+	return id < 0 ? T() : data[id];
+}
+
+template <class T>
+Box Flat_quadtree<T>::get_limit() const {
+	return limit;
+}
+
+template <class T>
+std::vector<Box> Flat_quadtree<T>::get_zones() const {
+	std::vector<Box> result;
+	result.reserve(zone_count);
+	for (size_t i = 0; i < zone_count; i++) {
+		float const* z = zones + 6 * i;
+		result.push_back(Box(Point(z[0], z[1], z[2]), Point(z[3], z[4], z[5])));
+	}
+	return result;
+}
+
+template <class T>
+size_t Flat_quadtree<T>::size() const {
+	return count;
+}
+
+template <class T>
+void Flat_quadtree<T>::set_key(uint64_t key_) {
+	key = key_;
+}
+
+template <class T>
+uint64_t Flat_quadtree<T>::get_key() const {
+	return key;
+}
+
+template <class T>
+size_t Flat_quadtree<T>::align(size_t offset, size_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+template <class T>
+bool Flat_quadtree<T>::is_valid(flat_node const* nodes, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		flat_node const& v = nodes[i];
+		bool split = v.type == NO_EMPTY_NODE;
+		if (!split && v.type != FULL_NODE) {
+			return false;
+		}
+		if ((v.children & ~(HAS_LEFT | HAS_RIGHT)) != 0 || (!split && v.children != 0)) {
+			return false;
+		}
+		// the left child is the next node, so the right one comes after
+		// the left subtree or right after the node without one
+		bool left = (v.children & HAS_LEFT) != 0;
+		if (left ? v.right <= i + 1 : v.right != i + 1) {
+			return false;
+		}
+		if (v.right > count || ((v.children & HAS_RIGHT) && v.right == count)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <class T>
+bool Flat_quadtree<T>::save(std::string const& path, std::string* error) const {
+	static_assert(std::is_trivially_copyable<T>::value, "snapshot payloads are stored byte for byte");
+	static_assert(alignof(T) <= 64, "padding between the arrays is at most 64 bytes");
+	snapshot_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "FLQTREE", 8);
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = 0x01020304;
+	header.payload_size = sizeof(T);
+	header.payload_align = alignof(T);
+	header.node_count = count;
+	header.zone_count = zone_count;
+	header.nodes_offset = align(sizeof(header), alignof(flat_node));
+	header.data_offset = align(header.nodes_offset + count * sizeof(flat_node), alignof(T));
+	header.zones_offset = align(header.data_offset + count * sizeof(T), alignof(float));
+	for (int j = 0; j < 3; j++) {
+		header.limit[j] = limit.first[j];
+		header.limit[3 + j] = limit.second[j];
+	}
+	header.key = key;
+
+	std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) {
+		if (error != nullptr) {
+			*error = "can't create " + path;
+		}
+		return false;
+	}
+	const char padding[64] = {};
+	size_t written = 0;
+	auto write = [&](size_t offset, void const* bytes, size_t size) {
+		out.write(padding, offset - written);
+		out.write(static_cast<char const*>(bytes), size);
+		written = offset + size;
+	};
+	write(0, &header, sizeof(header));
+	write(header.nodes_offset, nodes, count * sizeof(flat_node));
+	write(header.data_offset, data, count * sizeof(T));
+	write(header.zones_offset, zones, zone_count * 6 * sizeof(float));
+	out.close();
+	if (!out) {
+		if (error != nullptr) {
+			*error = "can't write " + path;
+		}
+		return false;
+	}
+	return true;
+}
+
+template <class T>
+std::unique_ptr<Flat_quadtree<T> > Flat_quadtree<T>::load(std::string const& path, std::string* error) {
+	static_assert(std::is_trivially_copyable<T>::value, "snapshot payloads are stored byte for byte");
+	auto fail = [&](std::string const& message) {
+		if (error != nullptr) {
+			*error = message;
+		}
+		return std::unique_ptr<Flat_quadtree>();
+	};
+	std::unique_ptr<Mapped_file> file(new Mapped_file(path));
+	if (!file->is_open()) {
+		return fail("can't open " + path);
+	}
+	snapshot_header header;
+	if (file->size() < sizeof(header)) {
+		return fail(path + " is not a quadtree snapshot");
+	}
+	memcpy(&header, file->data(), sizeof(header));
+	if (memcmp(header.magic, "FLQTREE", 8) != 0) {
+		return fail(path + " is not a quadtree snapshot");
+	}
+	if (header.version != SNAPSHOT_VERSION) {
+		return fail(path + " has snapshot version " + std::to_string(header.version) + ", expected "
+			+ std::to_string(SNAPSHOT_VERSION));
+	}
+	if (header.byte_order != 0x01020304) {
+		return fail(path + " was written with another byte order");
+	}
+	if (header.payload_size != sizeof(T) || header.payload_align != alignof(T)) {
+		return fail(path + " holds another node payload type");
+	}
+	// every array has to lie inside the file and be aligned for its type
+	uint64_t size = file->size();
+	bool fits = header.node_count < UINT32_MAX
+		&& header.nodes_offset % alignof(flat_node) == 0
+		&& header.data_offset % alignof(T) == 0
+		&& header.zones_offset % alignof(float) == 0
+		&& header.nodes_offset <= size && header.node_count <= (size - header.nodes_offset) / sizeof(flat_node)
+		&& header.data_offset <= size && header.node_count <= (size - header.data_offset) / sizeof(T)
+		&& header.zones_offset <= size && header.zone_count <= (size - header.zones_offset) / (6 * sizeof(float));
+	if (!fits) {
+		return fail(path + " is truncated or damaged");
+	}
+
+	char const* base = file->data();
+	if (!is_valid(reinterpret_cast<flat_node const*>(base + header.nodes_offset), header.node_count)) {
+		return fail(path + " has damaged nodes");
+	}
+	std::unique_ptr<Flat_quadtree> tree(new Flat_quadtree());
+	tree->nodes = reinterpret_cast<flat_node const*>(base + header.nodes_offset);
+	tree->data = reinterpret_cast<T const*>(base + header.data_offset);
+	tree->zones = reinterpret_cast<float const*>(base + header.zones_offset);
+	tree->count = static_cast<size_t>(header.node_count);
+	tree->zone_count = static_cast<size_t>(header.zone_count);
+	tree->limit = Box(Point(header.limit[0], header.limit[1], header.limit[2]),
+		Point(header.limit[3], header.limit[4], header.limit[5]));
+	tree->key = header.key;
+	tree->file = std::move(file);
+	return tree;
+}
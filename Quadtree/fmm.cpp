@@ -0,0 +1,63 @@
+#include "fmm.h"
+#include <algorithm>
+#include <cmath>
+
+Fmm_point_tree::Fmm_point_tree(std::vector<Point> const& points, int leaf_size) :
+	order(points.size()) {
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = static_cast<int>(i);
+	}
+	if (!order.empty()) {
+		nodes.reserve(2 * order.size() / leaf_size + 1);
+		build(points, leaf_size, 0, static_cast<int>(order.size()));
+	}
+}
+
+std::vector<int> const& Fmm_point_tree::get_order() const {
+	return order;
+}
+
+std::vector<Fmm_point_tree::node> const& Fmm_point_tree::get_nodes() const {
+	return nodes;
+}
+
+int Fmm_point_tree::build(std::vector<Point> const& points, int leaf_size, int first, int last) {
+	Point low = points[order[first]];
+	Point high = low;
+	for (int i = first + 1; i < last; i++) {
+		Point p = points[order[i]];
+		for (int j = 0; j < 3; j++) {
+			low[j] = std::min(low[j], p[j]);
+			high[j] = std::max(high[j], p[j]);
+		}
+	}
+	int id = static_cast<int>(nodes.size());
+	node t;
+	t.centre = (low + high) / 2;
+	t.radius = 0;
+	for (int i = first; i < last; i++) {
+		Point d = points[order[i]] - t.centre;
+		t.radius = std::max(t.radius, sqrtf(dot_product(d, d)));
+	}
+	t.first = first;
+	t.last = last;
+	t.children[0] = t.children[1] = -1;
+	nodes.push_back(t);
+	Point size = high - low;
+	int axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+	if (last - first <= leaf_size || size[axis] == 0) {
+		return id;
+	}
+	float s = t.centre[axis];
+	int mid = static_cast<int>(std::partition(order.begin() + first, order.begin() + last, [&](int i) {
+		return points[i][axis] < s;
+	}) - order.begin());
+	if (mid == first || mid == last) {
+		mid = (first + last) / 2;
+	}
+	int left = build(points, leaf_size, first, mid);
+	int right = build(points, leaf_size, mid, last);
+	nodes[id].children[0] = left;
+	nodes[id].children[1] = right;
+	return id;
+}
@@ -0,0 +1,764 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "geometry.h"
+#include "near_field.h"
+#include "physical_geometry.h"
+#include "quadtree.h"
+
+// Cartesian Taylor expansions of 1/r up to order P. A term is a
+// multi-index g = (gx, gy, gz) with gx + gy + gz <= P, terms are ordered
+// by degree so every term comes after the ones it is built from.
+//
+//   multipole about c:  M[a] = sum q (y - c)^a
+//   potential at c + R: sum (-1)^|a| M[a] D[a](R)
+//   local about c:      phi(c + z) = sum L[b] z^b
+//
+// where D[g](R) = d^g (1/|R|) / g! comes from the recurrence
+//   n |R|^2 D[g] = -(2n - 1) sum R_i D[g - e_i] - (n - 1) sum D[g - 2 e_i].
+template <int P>
+class Fmm_terms {
+public:
+	enum {
+		TERMS = (P + 1) * (P + 2) * (P + 3) / 6
+	};
+
+	// out[a] += factor * in[b] * other[c]
+	struct product {
+		int out;
+		int in;
+		int other;
+		double factor;
+	};
+
+	int power[TERMS][3];
+	int lower[TERMS][3];  // term g - e_i, -1 when g_i is 0
+	std::vector<product> m2m;
+	std::vector<product> m2l;
+	std::vector<product> l2l;
+
+	static Fmm_terms const& get();
+
+	// d^g for every term
+	void powers(double const* d, double* result) const;
+	// D[g](r) for every term
+	void derivatives(double const* r, double* result) const;
+
+private:
+	int index[P + 1][P + 1][P + 1];
+
+	Fmm_terms();
+	static double binomial(int n, int k);
+	int find(int x, int y, int z) const;
+};
+
+template <int P>
+Fmm_terms<P> const& Fmm_terms<P>::get() {
+	static Fmm_terms const terms;
+	return terms;
+}
+
+template <int P>
+double Fmm_terms<P>::binomial(int n, int k) {
+	double result = 1;
+	for (int i = 1; i <= k; i++) {
+		result = result * (n - k + i) / i;
+	}
+	return result;
+}
+
+template <int P>
+int Fmm_terms<P>::find(int x, int y, int z) const {
+	if (x < 0 || y < 0 || z < 0 || x + y + z > P) {
+		return -1;
+	}
+	return index[x][y][z];
+}
+
+template <int P>
+Fmm_terms<P>::Fmm_terms() {
+	int count = 0;
+	for (int n = 0; n <= P; n++) {
+		for (int x = n; x >= 0; x--) {
+			for (int y = n - x; y >= 0; y--) {
+				int z = n - x - y;
+				index[x][y][z] = count;
+				power[count][0] = x;
+				power[count][1] = y;
+				power[count][2] = z;
+				count++;
+			}
+		}
+	}
+	for (int t = 0; t < TERMS; t++) {
+		int const* g = power[t];
+		for (int i = 0; i < 3; i++) {
+			int h[3] = { g[0], g[1], g[2] };
+			h[i]--;
+			lower[t][i] = find(h[0], h[1], h[2]);
+		}
+	}
+	auto choose = [](int const* a, int const* b) {
+		return binomial(a[0], b[0]) * binomial(a[1], b[1]) * binomial(a[2], b[2]);
+	};
+	for (int a = 0; a < TERMS; a++) {
+		for (int b = 0; b < TERMS; b++) {
+			int const* pa = power[a];
+			int const* pb = power[b];
+			// b <= a
+			if (pb[0] <= pa[0] && pb[1] <= pa[1] && pb[2] <= pa[2]) {
+				int rest = find(pa[0] - pb[0], pa[1] - pb[1], pa[2] - pb[2]);
+				m2m.push_back(product{ a, b, rest, choose(pa, pb) });
+				l2l.push_back(product{ b, a, rest, choose(pa, pb) });
+			}
+			int sum[3] = { pa[0] + pb[0], pa[1] + pb[1], pa[2] + pb[2] };
+			int both = find(sum[0], sum[1], sum[2]);
+			if (both >= 0) {
+				int degree = pa[0] + pa[1] + pa[2];
+				m2l.push_back(product{ b, a, both, (degree % 2 ? -1 : 1) * choose(sum, pb) });
+			}
+		}
+	}
+}
+
+template <int P>
+void Fmm_terms<P>::powers(double const* d, double* result) const {
+	result[0] = 1;
+	for (int t = 1; t < TERMS; t++) {
+		int i = lower[t][0] >= 0 ? 0 : lower[t][1] >= 0 ? 1 : 2;
+		result[t] = result[lower[t][i]] * d[i];
+	}
+}
+
+template <int P>
+void Fmm_terms<P>::derivatives(double const* r, double* result) const {
+	double r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+	result[0] = 1 / sqrt(r2);
+	for (int t = 1; t < TERMS; t++) {
+		int const* g = power[t];
+		int n = g[0] + g[1] + g[2];
+		double sum = 0;
+		for (int i = 0; i < 3; i++) {
+			if (lower[t][i] < 0) {
+				continue;
+			}
+			sum -= (2 * n - 1) * r[i] * result[lower[t][i]];
+			int twice = lower[lower[t][i]][i];
+			if (twice >= 0) {
+				sum -= (n - 1) * result[twice];
+			}
+		}
+		result[t] = sum / (n * r2);
+	}
+}
+
+// Node payload for Fmm_quadtree: the multipole expansion of the charges
+// below the node about the centre of the boxes they came from. merge is
+// the M2M step, so building the tree builds the expansions.
+template <int P>
+class Fmm_node {
+public:
+	enum {
+		TERMS = Fmm_terms<P>::TERMS
+	};
+
+private:
+	Point low;
+	Point high;
+	float radius;  // the charges lie within radius of the centre
+	float weight;  // sum of |charge|, 0 for a node without charges
+	float moments[TERMS];
+
+	// all of the box is inside the objects when full, a part of it
+	// otherwise, see PObject::charge_in
+	static Fmm_node collect(std::vector<PObject const*> const& objects, Box limit, bool full);
+
+public:
+	Fmm_node();
+
+	static Fmm_node get_value(std::vector<PObject const*> const& objects, Box limit);
+	static Fmm_node get_surface_value(std::vector<PObject const*> const& objects, Box limit);
+	static Fmm_node merge(Fmm_node const& a, Fmm_node const& b);
+
+	Point get_centre() const;
+	float get_radius() const;
+	float get_charge() const;
+	float get_weight() const;
+	float const* get_moments() const;
+};
+
+template <int P>
+Fmm_node<P>::Fmm_node() :
+	radius(0),
+	weight(0),
+	moments() { }
+
+template <int P>
+Fmm_node<P> Fmm_node<P>::collect(std::vector<PObject const*> const& objects, Box limit, bool full) {
+	// as in Phy_node the volume charge of an object is one charge at the
+	// centroid of its part of the box, surface charges sit at the centroids
+	// of their triangles
+	Fmm_node result;
+	std::vector<std::pair<Point, float> > surface;
+	// a FULL box is inside one of the objects, the others may only cross
+	// it and are measured like in a surface box
+	bool whole = full && objects.size() == 1;
+	bool spread = false;
+	for (auto object : objects) {
+		if (object->has_surface_charges()) {
+			object->surface_charges_in(limit, surface);
+		}
+		else {
+			Point centre;
+			float charge = object->charge_in(limit, whole, centre);
+			surface.push_back(std::make_pair(centre, charge));
+			spread = spread || (!whole && charge != 0);
+		}
+	}
+	result.low = limit.first;
+	result.high = limit.second;
+	if (spread) {
+		// a share of a surface box, or of a node a lazy tree has not split,
+		// is spread through the box and not held at its centroid
+		Point half = (limit.second - limit.first) / 2;
+		result.radius = sqrtf(dot_product(half, half));
+	}
+	if (surface.empty()) {
+		return result;
+	}
+	Fmm_terms<P> const& terms = Fmm_terms<P>::get();
+	Point centre = result.get_centre();
+	double sum[TERMS] = {};
+	for (auto const& charge : surface) {
+		Point shift = charge.first - centre;
+		double d[3] = { shift.x, shift.y, shift.z };
+		double power[TERMS];
+		terms.powers(d, power);
+		for (int t = 0; t < TERMS; t++) {
+			sum[t] += charge.second * power[t];
+		}
+		result.radius = std::max(result.radius, sqrtf(dot_product(shift, shift)));
+		result.weight += fabsf(charge.second);
+	}
+	for (int t = 0; t < TERMS; t++) {
+		result.moments[t] += static_cast<float>(sum[t]);
+	}
+	return result;
+}
+
+template <int P>
+Fmm_node<P> Fmm_node<P>::get_value(std::vector<PObject const*> const& objects, Box limit) {
+	return collect(objects, limit, true);
+}
+
+template <int P>
+Fmm_node<P> Fmm_node<P>::get_surface_value(std::vector<PObject const*> const& objects, Box limit) {
+	return collect(objects, limit, false);
+}
+
+template <int P>
+Fmm_node<P> Fmm_node<P>::merge(Fmm_node const& a, Fmm_node const& b) {
+	if (b.weight == 0) {
+		return a;
+	}
+	if (a.weight == 0) {
+		return b;
+	}
+	Fmm_terms<P> const& terms = Fmm_terms<P>::get();
+	Fmm_node result;
+	for (int i = 0; i < 3; i++) {
+		result.low[i] = std::min(a.low[i], b.low[i]);
+		result.high[i] = std::max(a.high[i], b.high[i]);
+	}
+	Point centre = result.get_centre();
+	double sum[TERMS] = {};
+	for (Fmm_node const* child : { &a, &b }) {
+		Point shift = child->get_centre() - centre;
+		double d[3] = { shift.x, shift.y, shift.z };
+		double power[TERMS];
+		terms.powers(d, power);
+		for (auto const& m : terms.m2m) {
+			sum[m.out] += m.factor * child->moments[m.in] * power[m.other];
+		}
+		float reach = sqrtf(dot_product(shift, shift)) + child->radius;
+		result.radius = std::max(result.radius, reach);
+	}
+	for (int t = 0; t < TERMS; t++) {
+		result.moments[t] = static_cast<float>(sum[t]);
+	}
+	result.weight = a.weight + b.weight;
+	return result;
+}
+
+template <int P>
+Point Fmm_node<P>::get_centre() const {
+	return (low + high) / 2;
+}
+
+template <int P>
+float Fmm_node<P>::get_radius() const {
+	return radius;
+}
+
+template <int P>
+float Fmm_node<P>::get_charge() const {
+	return moments[0];
+}
+
+template <int P>
+float Fmm_node<P>::get_weight() const {
+	return weight;
+}
+
+template <int P>
+float const* Fmm_node<P>::get_moments() const {
+	return moments;
+}
+
+// Binary tree over a set of points, cut at the middle of the longest side
+// of their bounds. The FMM walks keep their query points and their point
+// charges in it.
+class Fmm_point_tree {
+public:
+	struct node {
+		Point centre;  // of the bounds of the points
+		float radius;  // the points lie within radius of the centre
+		int first;     // the points are order[first, last)
+		int last;
+		int children[2];  // -1 for a leaf
+	};
+
+	Fmm_point_tree(std::vector<Point> const& points, int leaf_size);
+
+	std::vector<int> const& get_order() const;
+	// the root comes first and children after their parent
+	std::vector<node> const& get_nodes() const;
+
+private:
+	std::vector<int> order;
+	std::vector<node> nodes;
+
+	int build(std::vector<Point> const& points, int leaf_size, int first, int last);
+};
+
+// Fast multipole evaluation of the Coulomb field of the same charges
+// Physical_quadtree sees. The query points get a tree of their own and
+// both trees are walked together: a pair of nodes that is well separated,
+// (r_source + r_target) < theta * distance, adds a local expansion to the
+// target node (M2L), the locals are pushed down (L2L) and evaluated at
+// the points (L2P), pairs of leaves that are close are summed directly
+// over the charges of the source leaf, see Near_sources. The cost grows
+// linearly with the number of points.
+template <int P>
+class Fmm_quadtree : public Quadtree<Fmm_node<P> > {
+	typedef Quadtree<Fmm_node<P> > base;
+	typedef typename base::node node;
+
+	enum {
+		TERMS = Fmm_terms<P>::TERMS,
+		LEAF_SIZE = 16
+	};
+
+	// state of one evaluation
+	struct walk {
+		std::vector<Point> const& points;
+		Fmm_point_tree targets;
+		std::vector<double> locals;  // TERMS per target node
+		std::vector<double> field;   // 4 per point, the last one is the potential
+	};
+
+	float theta;
+
+	// the charges of a leaf for the direct sums, as in Physical_quadtree
+	// found when a walk first reaches the leaf and again after an update
+	mutable std::shared_mutex near_lock;
+	mutable std::unordered_map<node const*, Near_sources> near_lists;
+
+	Near_sources const& near_of(node const* leaf) const;
+	void updated() override;
+
+	// splits a node of a lazy tree only when it opens it
+	void interact(walk& w, node const* source, int target) const;
+	void add_local(walk& w, Fmm_node<P> const& source, int target) const;
+	void add_direct(walk& w, node const* source, int target) const;
+	void push_down(walk& w, int target) const;
+
+public:
+	Fmm_quadtree(std::vector<PObject> const& objects, Box const& limit, float theta = 0.5f,
+		Build_settings const& settings = Build_settings(), typename base::node_pool* arena = nullptr);
+	Fmm_quadtree(Scene& scene, Box const& limit, float theta = 0.5f,
+		Build_settings const& settings = Build_settings(), typename base::node_pool* arena = nullptr);
+
+	void set_theta(float theta);
+	float get_theta() const;
+
+	// Coulomb field and potential in units with k = 1
+	Point field_at(Point p) const;
+	float potential_at(Point p) const;
+	void field_at(std::vector<Point> const& points, std::vector<Point>& field,
+		std::vector<float>* potential = nullptr) const;
+};
+
+template <int P>
+Fmm_quadtree<P>::Fmm_quadtree(std::vector<PObject> const& objects, Box const& limit, float theta,
+	Build_settings const& settings, typename base::node_pool* arena) :
+	base(objects, limit, settings, arena),
+	theta(theta) { }
+
+template <int P>
+Fmm_quadtree<P>::Fmm_quadtree(Scene& scene, Box const& limit, float theta,
+	Build_settings const& settings, typename base::node_pool* arena) :
+	base(scene, limit, settings, arena),
+	theta(theta) { }
+
+template <int P>
+void Fmm_quadtree<P>::set_theta(float theta_) {
+	theta = theta_;
+}
+
+template <int P>
+float Fmm_quadtree<P>::get_theta() const {
+	return theta;
+}
+
+template <int P>
+Near_sources const& Fmm_quadtree<P>::near_of(node const* leaf) const {
+	{
+		std::shared_lock<std::shared_mutex> lock(near_lock);
+		auto found = near_lists.find(leaf);
+		if (found != near_lists.end()) {
+			return found->second;
+		}
+	}
+	Fmm_node<P> const& data = leaf->data;
+	Point centre = data.get_centre();
+	float q = data.get_charge();
+	if (P > 0 && q != 0) {
+		// the centre of the charges from the dipole moment
+		float const* moments = data.get_moments();
+		centre = centre + Point(moments[1], moments[2], moments[3]) / q;
+	}
+	Near_sources sources(this->get_scene(), leaf->limit, leaf->type == FULL_NODE, q, centre);
+	std::lock_guard<std::shared_mutex> lock(near_lock);
+	return near_lists.emplace(leaf, std::move(sources)).first->second;
+}
+
+template <int P>
+void Fmm_quadtree<P>::updated() {
+	near_lists.clear();
+}
+
+template <int P>
+void Fmm_quadtree<P>::interact(walk& w, node const* source, int target) const {
+	if (source == nullptr || source->data.get_weight() == 0) {
+		return;
+	}
+	Fmm_node<P> const& s = source->data;
+	Fmm_point_tree::node const& t = w.targets.get_nodes()[target];
+	Point d = t.centre - s.get_centre();
+	float reach = s.get_radius() + t.radius;
+	if (reach * reach < theta * theta * dot_product(d, d)) {
+		add_local(w, s, target);
+		return;
+	}
+	this->split(const_cast<node*>(source));
+	bool source_leaf = base::is_leaf(source);
+	bool target_leaf = t.children[0] < 0;
+	if (source_leaf && target_leaf) {
+		add_direct(w, source, target);
+		return;
+	}
+	// open the larger of the two
+	if (!source_leaf && (target_leaf || s.get_radius() >= t.radius)) {
+		for (node const* child : source->children) {
+			interact(w, child, target);
+		}
+		return;
+	}
+	int children[2] = { t.children[0], t.children[1] };
+	for (int child : children) {
+		interact(w, source, child);
+	}
+}
+
+template <int P>
+void Fmm_quadtree<P>::add_local(walk& w, Fmm_node<P> const& source, int target) const {
+	Fmm_terms<P> const& terms = Fmm_terms<P>::get();
+	Point shift = w.targets.get_nodes()[target].centre - source.get_centre();
+	double r[3] = { shift.x, shift.y, shift.z };
+	double derivative[TERMS];
+	terms.derivatives(r, derivative);
+	float const* moments = source.get_moments();
+	double* local = &w.locals[static_cast<size_t>(target) * TERMS];
+	for (auto const& m : terms.m2l) {
+		local[m.out] += m.factor * moments[m.in] * derivative[m.other];
+	}
+}
+
+template <int P>
+void Fmm_quadtree<P>::add_direct(walk& w, node const* source, int target) const {
+	Near_sources const& sources = near_of(source);
+	Fmm_point_tree::node const& t = w.targets.get_nodes()[target];
+	for (int i = t.first; i < t.last; i++) {
+		int id = w.targets.get_order()[i];
+		Point field;
+		float potential = 0;
+		sources.add_field(w.points[id], field, potential);
+		double* out = &w.field[4 * static_cast<size_t>(id)];
+		out[0] += field.x;
+		out[1] += field.y;
+		out[2] += field.z;
+		out[3] += potential;
+	}
+}
+
+template <int P>
+void Fmm_quadtree<P>::push_down(walk& w, int target) const {
+	Fmm_terms<P> const& terms = Fmm_terms<P>::get();
+	Fmm_point_tree::node const& t = w.targets.get_nodes()[target];
+	double const* local = &w.locals[static_cast<size_t>(target) * TERMS];
+	if (t.children[0] >= 0) {
+		for (int child : t.children) {
+			Point shift = w.targets.get_nodes()[child].centre - t.centre;
+			double d[3] = { shift.x, shift.y, shift.z };
+			double power[TERMS];
+			terms.powers(d, power);
+			double* out = &w.locals[static_cast<size_t>(child) * TERMS];
+			for (auto const& m : terms.l2l) {
+				out[m.out] += m.factor * local[m.in] * power[m.other];
+			}
+			push_down(w, child);
+		}
+		return;
+	}
+	// E = -grad phi of phi(c + z) = sum L[b] z^b
+	for (int i = t.first; i < t.last; i++) {
+		int id = w.targets.get_order()[i];
+		Point z = w.points[id] - t.centre;
+		double d[3] = { z.x, z.y, z.z };
+		double power[TERMS];
+		terms.powers(d, power);
+		double* out = &w.field[4 * static_cast<size_t>(id)];
+		for (int b = 0; b < TERMS; b++) {
+			out[3] += local[b] * power[b];
+			for (int j = 0; j < 3; j++) {
+				int lower = terms.lower[b][j];
+				if (lower >= 0) {
+					out[j] -= terms.power[b][j] * local[b] * power[lower];
+				}
+			}
+		}
+	}
+}
+
+template <int P>
+void Fmm_quadtree<P>::field_at(std::vector<Point> const& points, std::vector<Point>& field,
+	std::vector<float>* potential) const {
+	field.assign(points.size(), Point());
+	if (potential != nullptr) {
+		potential->assign(points.size(), 0);
+	}
+	if (points.empty()) {
+		return;
+	}
+	walk w{ points, Fmm_point_tree(points, LEAF_SIZE), std::vector<double>(),
+		std::vector<double>(4 * points.size()) };
+	w.locals.assign(w.targets.get_nodes().size() * TERMS, 0);
+	interact(w, this->root, 0);
+	push_down(w, 0);
+	for (size_t i = 0; i < points.size(); i++) {
+		double const* out = &w.field[4 * i];
+		field[i] = Point(static_cast<float>(out[0]), static_cast<float>(out[1]), static_cast<float>(out[2]));
+		if (potential != nullptr) {
+			(*potential)[i] = static_cast<float>(out[3]);
+		}
+	}
+}
+
+template <int P>
+Point Fmm_quadtree<P>::field_at(Point p) const {
+	std::vector<Point> field;
+	field_at(std::vector<Point>(1, p), field);
+	return field[0];
+}
+
+template <int P>
+float Fmm_quadtree<P>::potential_at(Point p) const {
+	std::vector<Point> field;
+	std::vector<float> potential;
+	field_at(std::vector<Point>(1, p), field, &potential);
+	return potential[0];
+}
+
+// Potentials of a fixed set of point charges at the charges themselves,
+// for solvers that ask for many products with the same points and new
+// charges. The tree and the lists of interacting node pairs are found
+// once, a product only redoes the expansions along the lists.
+template <int P>
+class Point_fmm {
+	enum {
+		TERMS = Fmm_terms<P>::TERMS,
+		LEAF_SIZE = 16
+	};
+
+	std::vector<Point> points;
+	Fmm_point_tree tree;
+	std::vector<std::pair<int, int> > far;   // source node, target node, M2L
+	std::vector<std::pair<int, int> > near;  // source leaf, target leaf, summed directly
+
+	void find_pairs(int source, int target, float theta);
+
+public:
+	explicit Point_fmm(std::vector<Point> points, float theta = 0.5f);
+
+	size_t size() const;
+	// result[i] = sum over j != i of charges[j] / |p_i - p_j|, points
+	// closer than 1e-6 do not see each other
+	void potential(std::vector<double> const& charges, std::vector<double>& result) const;
+};
+
+template <int P>
+Point_fmm<P>::Point_fmm(std::vector<Point> points_, float theta) :
+	points(std::move(points_)),
+	tree(points, LEAF_SIZE) {
+	if (!points.empty()) {
+		find_pairs(0, 0, theta);
+	}
+}
+
+template <int P>
+size_t Point_fmm<P>::size() const {
+	return points.size();
+}
+
+template <int P>
+void Point_fmm<P>::find_pairs(int source, int target, float theta) {
+	Fmm_point_tree::node const& s = tree.get_nodes()[source];
+	Fmm_point_tree::node const& t = tree.get_nodes()[target];
+	Point d = t.centre - s.centre;
+	float reach = s.radius + t.radius;
+	if (source != target && reach * reach < theta * theta * dot_product(d, d)) {
+		far.push_back(std::make_pair(source, target));
+		return;
+	}
+	bool source_leaf = s.children[0] < 0;
+	bool target_leaf = t.children[0] < 0;
+	if (source_leaf && target_leaf) {
+		near.push_back(std::make_pair(source, target));
+		return;
+	}
+	if (!source_leaf && (target_leaf || s.radius >= t.radius)) {
+		int children[2] = { s.children[0], s.children[1] };
+		for (int child : children) {
+			find_pairs(child, target, theta);
+		}
+		return;
+	}
+	int children[2] = { t.children[0], t.children[1] };
+	for (int child : children) {
+		find_pairs(source, child, theta);
+	}
+}
+
+template <int P>
+void Point_fmm<P>::potential(std::vector<double> const& charges, std::vector<double>& result) const {
+	const double MIN_DISTANCE = 1e-6;
+	result.assign(points.size(), 0);
+	if (points.empty()) {
+		return;
+	}
+	Fmm_terms<P> const& terms = Fmm_terms<P>::get();
+	std::vector<Fmm_point_tree::node> const& nodes = tree.get_nodes();
+	std::vector<int> const& order = tree.get_order();
+	std::vector<double> moments(nodes.size() * TERMS);
+	std::vector<double> locals(nodes.size() * TERMS);
+	double power[TERMS];
+
+	// P2M at the leaves and M2M up, children come after their parent
+	for (size_t id = nodes.size(); id-- > 0;) {
+		Fmm_point_tree::node const& cur = nodes[id];
+		double* out = &moments[id * TERMS];
+		if (cur.children[0] < 0) {
+			for (int i = cur.first; i < cur.last; i++) {
+				Point shift = points[order[i]] - cur.centre;
+				double d[3] = { shift.x, shift.y, shift.z };
+				terms.powers(d, power);
+				for (int t = 0; t < TERMS; t++) {
+					out[t] += charges[order[i]] * power[t];
+				}
+			}
+			continue;
+		}
+		for (int child : cur.children) {
+			Point shift = nodes[child].centre - cur.centre;
+			double d[3] = { shift.x, shift.y, shift.z };
+			terms.powers(d, power);
+			double const* in = &moments[static_cast<size_t>(child) * TERMS];
+			for (auto const& m : terms.m2m) {
+				out[m.out] += m.factor * in[m.in] * power[m.other];
+			}
+		}
+	}
+
+	double derivative[TERMS];
+	for (auto const& pair : far) {
+		Point shift = nodes[pair.second].centre - nodes[pair.first].centre;
+		double r[3] = { shift.x, shift.y, shift.z };
+		terms.derivatives(r, derivative);
+		double const* in = &moments[static_cast<size_t>(pair.first) * TERMS];
+		double* out = &locals[static_cast<size_t>(pair.second) * TERMS];
+		for (auto const& m : terms.m2l) {
+			out[m.out] += m.factor * in[m.in] * derivative[m.other];
+		}
+	}
+
+	// L2L down and L2P at the leaves
+	for (size_t id = 0; id < nodes.size(); id++) {
+		Fmm_point_tree::node const& cur = nodes[id];
+		double const* local = &locals[id * TERMS];
+		if (cur.children[0] >= 0) {
+			for (int child : cur.children) {
+				Point shift = nodes[child].centre - cur.centre;
+				double d[3] = { shift.x, shift.y, shift.z };
+				terms.powers(d, power);
+				double* out = &locals[static_cast<size_t>(child) * TERMS];
+				for (auto const& m : terms.l2l) {
+					out[m.out] += m.factor * local[m.in] * power[m.other];
+				}
+			}
+			continue;
+		}
+		for (int i = cur.first; i < cur.last; i++) {
+			Point shift = points[order[i]] - cur.centre;
+			double d[3] = { shift.x, shift.y, shift.z };
+			terms.powers(d, power);
+			double sum = 0;
+			for (int t = 0; t < TERMS; t++) {
+				sum += local[t] * power[t];
+			}
+			result[order[i]] += sum;
+		}
+	}
+
+	for (auto const& pair : near) {
+		Fmm_point_tree::node const& s = nodes[pair.first];
+		Fmm_point_tree::node const& t = nodes[pair.second];
+		for (int i = t.first; i < t.last; i++) {
+			Point p = points[order[i]];
+			double sum = 0;
+			for (int j = s.first; j < s.last; j++) {
+				Point d = p - points[order[j]];
+				double dist = sqrt(static_cast<double>(dot_product(d, d)));
+				if (dist >= MIN_DISTANCE) {
+					sum += charges[order[j]] / dist;
+				}
+			}
+			result[order[i]] += sum;
+		}
+	}
+}
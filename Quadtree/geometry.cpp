@@ -1,9 +1,19 @@
 #include "geometry.h"
+#include "bvh.h"
+#include "stats.h"
+#include "vertex_weld.h"
 #include <cassert>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <map>
+#include <mutex>
+#include <utility>
 
 const float eps = 1e-3f;
+// relative slack of cross_triangle_box, a triangle that only touches the
+// boundary of a box does not cross it
+const float TOUCH_EPS = 1e-5f;
 
 bool is_zero(float x) {
 	return abs(x) < eps;
@@ -46,18 +56,39 @@ float dot_product(Point a, Point b) {
 	return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
+Point_batch::Point_batch() { }
+
+Point_batch::Point_batch(std::vector<Point> const& points) {
+	x.reserve(points.size());
+	y.reserve(points.size());
+	z.reserve(points.size());
+	for (Point p : points) {
+		push_back(p);
+	}
+}
+
+void Point_batch::push_back(Point p) {
+	x.push_back(p.x);
+	y.push_back(p.y);
+	z.push_back(p.z);
+}
+
+size_t Point_batch::size() const {
+	return x.size();
+}
+
+Point Point_batch::operator[](size_t i) const {
+	return Point(x[i], y[i], z[i]);
+}
+
+Triangle::Triangle() { }
+
 Triangle::Triangle(Point a, Point b, Point c) {
 	points[0] = a;
 	points[1] = b;
 	points[2] = c;
 }
 
-Triangle::Triangle(Triangle const& b) {
-	points[0] = b.points[0];
-	points[1] = b.points[1];
-	points[2] = b.points[2];
-}
-
 Triangle::iterator Triangle::begin() {
 	return points;
 }
@@ -66,12 +97,25 @@ Triangle::iterator Triangle::end() {
 	return points + 3;
 }
 
-Point Triangle::operator[](size_t x) {
+Point Triangle::operator[](size_t x) const {
 	assert(x < 3);
 	return points[x];
 }
 
-Interval get_interval(Triangle triangle, Point axis) {
+size_t Indexed_mesh::size() const {
+	return indices.size() / 3;
+}
+
+Point Indexed_mesh::corner(size_t triangle, int k) const {
+	uint32_t v = indices[3 * triangle + k];
+	return Point(vertices.x[v], vertices.y[v], vertices.z[v]);
+}
+
+Triangle Indexed_mesh::triangle(size_t i) const {
+	return Triangle(corner(i, 0), corner(i, 1), corner(i, 2));
+}
+
+Interval get_interval(Triangle const& triangle, Point axis) {
 	Interval result;
 
 	result.min = dot_product(axis, triangle.points[0]);
@@ -85,20 +129,20 @@ Interval get_interval(Triangle triangle, Point axis) {
 	return result;
 }
 
-bool overlap_on_axis(Triangle t1, Triangle t2, Point axis) {
+bool overlap_on_axis(Triangle const& t1, Triangle const& t2, Point axis) {
 	Interval a = get_interval(t1, axis);
 	Interval b = get_interval(t2, axis);
 	return ((b.min <= a.max) && (a.min <= b.max));
 }
 
-bool cross_triangle_triangle(Triangle t1, Triangle t2) {
-	Point t1_f0 = t1.b - t1.a; // Edges t1
-	Point t1_f1 = t1.c - t1.b;
-	Point t1_f2 = t1.a - t1.c;
+bool cross_triangle_triangle(Triangle const& t1, Triangle const& t2) {
+	Point t1_f0 = t1.points[1] - t1.points[0]; // Edges t1
+	Point t1_f1 = t1.points[2] - t1.points[1];
+	Point t1_f2 = t1.points[0] - t1.points[2];
 
-	Point t2_f0 = t2.b - t2.a; // Edges t2
-	Point t2_f1 = t2.c - t2.b;
-	Point t2_f2 = t2.a - t2.c;
+	Point t2_f0 = t2.points[1] - t2.points[0]; // Edges t2
+	Point t2_f1 = t2.points[2] - t2.points[1];
+	Point t2_f2 = t2.points[0] - t2.points[2];
 
 	Point axisToTest[] = {
 		// Triangle 1, Normal
@@ -128,6 +172,10 @@ bool cross_triangle_triangle(Triangle t1, Triangle t2) {
 	return true; // Seperating axis not found
 }
 
+Box::Box() :
+	first(),
+	second() { }
+
 Box::Box(Point first, Point second) :
 	first(first),
 	second(second) { }
@@ -158,50 +206,271 @@ std::vector<Point> Box::get_points() const {
 	return temp;
 }
 
+bool cross_triangle_box(Triangle const& t, Box const& box) {
+	Point centre = (box.first + box.second) / 2;
+	Point half = (box.second - box.first) / 2;
+	Point v[3] = {
+		t.points[0] - centre,
+		t.points[1] - centre,
+		t.points[2] - centre
+	};
+
+	// Box normals
+	for (int i = 0; i < 3; i++) {
+		float low = fminf(v[0][i], fminf(v[1][i], v[2][i]));
+		float high = fmaxf(v[0][i], fmaxf(v[1][i], v[2][i]));
+		float radius = half[i] * (1 - TOUCH_EPS);
+		if (low >= radius || high <= -radius) {
+			return false;
+		}
+	}
+
+	// Cross products of box normals and triangle edges
+	Point edges[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+	for (int i = 0; i < 3; i++) {
+		Point normal;
+		normal[i] = 1;
+		for (int j = 0; j < 3; j++) {
+			Point axis = cross_product(normal, edges[j]);
+			float p0 = dot_product(axis, v[0]);
+			float p1 = dot_product(axis, v[1]);
+			float p2 = dot_product(axis, v[2]);
+			float radius = half.x * fabsf(axis.x) + half.y * fabsf(axis.y) + half.z * fabsf(axis.z);
+			radius *= 1 - TOUCH_EPS;
+			if (fminf(p0, fminf(p1, p2)) > radius || fmaxf(p0, fmaxf(p1, p2)) < -radius) {
+				return false;
+			}
+		}
+	}
+
+	// Triangle normal
+	Point normal = cross_product(edges[0], edges[1]);
+	float radius = half.x * fabsf(normal.x) + half.y * fabsf(normal.y) + half.z * fabsf(normal.z);
+	return fabsf(dot_product(normal, v[0])) < radius * (1 - TOUCH_EPS);
+}
+
+void add_to_packet(Triangle_packet& packet, Triangle const& t) {
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			packet.v[3 * i + j][packet.size] = t.points[i][j];
+		}
+	}
+	packet.size++;
+}
+
+void add_to_packet(Triangle_packet& packet, Indexed_mesh const& mesh, size_t triangle) {
+	for (int i = 0; i < 3; i++) {
+		uint32_t v = mesh.indices[3 * triangle + i];
+		packet.v[3 * i][packet.size] = mesh.vertices.x[v];
+		packet.v[3 * i + 1][packet.size] = mesh.vertices.y[v];
+		packet.v[3 * i + 2][packet.size] = mesh.vertices.z[v];
+	}
+	packet.size++;
+}
+
+// The share of every cell of the bounds of an Object inside it, x
+// fastest, see Object::volume_in
+struct Volume_grid {
+	enum { CELLS = 16 };
+
+	std::once_flag filled;
+	std::vector<float> fill;
+};
+
+namespace {
+	// A point of box picked by a hash of its corner. The same box always
+	// gets the same point, and the boxes along a flat surface do not all
+	// put it on the same side.
+	Point sample_point(Box const& box) {
+		uint32_t hash = 2166136261u;
+		for (int j = 0; j < 3; j++) {
+			float corner = box.first[j];
+			uint32_t bits;
+			memcpy(&bits, &corner, sizeof(bits));
+			hash = (hash ^ bits) * 16777619u;
+		}
+		Point p;
+		for (int j = 0; j < 3; j++) {
+			hash = hash * 1664525u + 1013904223u;
+			float share = (hash >> 8) * (1.0f / (1 << 24));
+			p[j] = box.first[j] + share * (box.second[j] - box.first[j]);
+		}
+		return p;
+	}
+
+	Triangle packet_triangle(Triangle_packet const& packet, int i) {
+		return Triangle(
+			Point(packet.v[0][i], packet.v[1][i], packet.v[2][i]),
+			Point(packet.v[3][i], packet.v[4][i], packet.v[5][i]),
+			Point(packet.v[6][i], packet.v[7][i], packet.v[8][i])
+		);
+	}
+}
+
+void cross_triangle_triangles(Triangle const& t, Triangle_packet const& packet, uint8_t* result) {
+	QT_COUNT(SAT_TRIANGLE_TESTS, packet.size);
+#if SIMD_X86
+	float flat[9];
+	for (int i = 0; i < 9; i++) {
+		flat[i] = t.points[i / 3][i % 3];
+	}
+	switch (simd_level()) {
+	case SIMD_AVX512:
+		sat_triangles_avx512(flat, packet, result);
+		return;
+	case SIMD_AVX2:
+		sat_triangles_avx2(flat, packet, result);
+		return;
+	case SIMD_SSE:
+		sat_triangles_sse(flat, packet, result);
+		return;
+	default:
+		break;
+	}
+#endif
+	for (int i = 0; i < packet.size; i++) {
+		result[i] = cross_triangle_triangle(t, packet_triangle(packet, i));
+	}
+}
+
+void cross_box_triangles(Box const& box, Triangle_packet const& packet, uint8_t* result) {
+	QT_COUNT(SAT_BOX_TESTS, packet.size);
+#if SIMD_X86
+	float flat[6] = {
+		box.first.x, box.first.y, box.first.z,
+		box.second.x, box.second.y, box.second.z
+	};
+	switch (simd_level()) {
+	case SIMD_AVX512:
+		sat_box_avx512(flat, 1 - TOUCH_EPS, packet, result);
+		return;
+	case SIMD_AVX2:
+		sat_box_avx2(flat, 1 - TOUCH_EPS, packet, result);
+		return;
+	case SIMD_SSE:
+		sat_box_sse(flat, 1 - TOUCH_EPS, packet, result);
+		return;
+	default:
+		break;
+	}
+#endif
+	for (int i = 0; i < packet.size; i++) {
+		result[i] = cross_triangle_box(packet_triangle(packet, i), box);
+	}
+}
+
+Transform::Transform() :
+	rotation{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+	shift(0, 0, 0) { }
+
+Transform Transform::translation(Point shift) {
+	Transform result;
+	result.shift = shift;
+	return result;
+}
+
+Point Transform::apply(Point p) const {
+	Point result = shift;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			result[i] += rotation[i][j] * p[j];
+		}
+	}
+	return result;
+}
+
 float tetrahedron_volume(Point a, Point b, Point c, Point d) {
 	b -= d , c -= d , a -= d;
 	return dot_product(a, cross_product(b, c)) / 6;
 }
 
-float tetrahedron_volume(Point a, Triangle tr) {
+float tetrahedron_volume(Point a, Triangle const& tr) {
 	return tetrahedron_volume(a, tr[0], tr[1], tr[2]);
 }
 
-Object::Object(const std::vector<Point>& points, std::vector<std::vector<int> > connect) :
-	points(points) {
-	for (auto v : connect) {
-		polygones.push_back(Triangle(
-			points[v[0]],
-			points[v[1]],
-			points[v[2]]
-		));
+Object::Object(const std::vector<Point>& points, std::vector<std::vector<int> > connect) {
+	// already indexed, so the points are taken as they are
+	for (Point p : points) {
+		mesh.vertices.push_back(p);
+	}
+	for (auto const& v : connect) {
+		for (int i = 0; i < 3; i++) {
+			mesh.indices.push_back(static_cast<uint32_t>(v[i]));
+		}
 	}
 	init();
 }
 
-Object::iterator Object::begin() {
-	return polygones.begin();
-}
-
-Object::iterator Object::end() {
-	return polygones.end();
+void Object::init(std::vector<Triangle> const& triangles, Thread_pool* pool) {
+	weld_vertices(triangles, eps, mesh, pool);
+	init();
 }
 
 void Object::init() {
-	// calc volume and unique points
-	real_volume = 0;
-	for (Triangle v : polygones) {
-		real_volume += tetrahedron_volume(Point(), v);
-		for (Point u : v) {
-			points.push_back(u);
+	// bounds of the used vertices and the triangle hierarchy
+	bounds = Box();
+	for (size_t i = 0; i < mesh.indices.size(); i++) {
+		Point v = mesh.vertices[mesh.indices[i]];
+		if (i == 0) {
+			bounds = Box(v, v);
+		}
+		for (int j = 0; j < 3; j++) {
+			bounds.first[j] = fminf(bounds.first[j], v[j]);
+			bounds.second[j] = fmaxf(bounds.second[j], v[j]);
 		}
 	}
-	real_volume = abs(real_volume);
-	sort(points.begin(), points.end());
-	points.resize(unique(points.begin(), points.end()) - points.begin());
+	bvh = std::make_shared<Triangle_bvh>(mesh);
+	grid = std::make_shared<Volume_grid>();
+	// signed tetrahedra from the middle of the bounds to every triangle
+	Point mid = (bounds.first + bounds.second) / 2;
+	double sum = 0;
+	for (size_t i = 0; i < mesh.size(); i++) {
+		sum += tetrahedron_volume(mid, mesh.triangle(i));
+	}
+	volume = static_cast<float>(fabs(sum));
 }
 
-Object::Object(const std::vector<Triangle>& trianguals): polygones(trianguals) {
+void Object::transform(Transform const& t) {
+	Point_batch& v = mesh.vertices;
+	for (size_t i = 0; i < v.size(); i++) {
+		Point p = t.apply(v[i]);
+		v.x[i] = p.x;
+		v.y[i] = p.y;
+		v.z[i] = p.z;
+	}
+	init();
+}
+
+size_t Object::size() const {
+	return mesh.size();
+}
+
+Triangle Object::triangle(size_t i) const {
+	return mesh.triangle(i);
+}
+
+Indexed_mesh const& Object::get_mesh() const {
+	return mesh;
+}
+
+Box Object::get_bounds() const {
+	return bounds;
+}
+
+float Object::get_volume() const {
+	return volume;
+}
+
+Object::Object(const std::vector<Triangle>& trianguals) {
+	init(trianguals);
+}
+
+Object::Object(std::vector<Triangle> const& trianguals, Thread_pool* pool) {
+	init(trianguals, pool);
+}
+
+Object::Object(Indexed_mesh mesh) :
+	mesh(std::move(mesh)) {
 	init();
 }
 
@@ -226,6 +495,7 @@ int bit_count(int x) {
 }
 
 Object::Object(Box rectangle) {
+	std::vector<Triangle> polygones;
 	Point mid = (rectangle.first + rectangle.second) / 2;
 	for (int i = 0; i < 8; i++) {
 		Point p;
@@ -257,47 +527,161 @@ Object::Object(Box rectangle) {
 			}
 		}
 	}
-	init();
+	init(polygones);
+}
+
+bool Object::contains(Point p) const {
+	QT_COUNT(CONTAINS_CALLS, 1);
+	return bvh->contains(mesh, p);
+}
+
+float Object::volume_in(Box const& limit, Point* centre) const {
+	const int CELLS = Volume_grid::CELLS;
+	Volume_grid& cells = *grid;
+	std::call_once(cells.filled, [&] {
+		std::vector<int> near;
+		candidates(bounds, near);
+		int first[3] = { 0, 0, 0 };
+		int last[3] = { CELLS, CELLS, CELLS };
+		cells.fill.assign(CELLS * CELLS * CELLS, 0);
+		fill_cells(bounds, first, last, near, cells.fill);
+	});
+	// the overlap of limit with every cell along each axis, as a length
+	// and its middle
+	if (centre != nullptr) {
+		*centre = (limit.first + limit.second) / 2;
+	}
+	int low[3];
+	int high[3];
+	float length[3][CELLS];
+	float mid[3][CELLS];
+	for (int j = 0; j < 3; j++) {
+		float from = std::max(limit.first[j], bounds.first[j]);
+		float to = std::min(limit.second[j], bounds.second[j]);
+		float cell = (bounds.second[j] - bounds.first[j]) / CELLS;
+		if (!(from < to) || !(cell > 0)) {
+			return 0;
+		}
+		low[j] = std::min(CELLS - 1, std::max(0, static_cast<int>((from - bounds.first[j]) / cell)));
+		high[j] = std::min(CELLS - 1, std::max(0, static_cast<int>((to - bounds.first[j]) / cell))) + 1;
+		for (int c = low[j]; c < high[j]; c++) {
+			float a = std::max(from, cell_edge(j, c));
+			float b = std::min(to, cell_edge(j, c + 1));
+			length[j][c] = std::max(b - a, 0.0f);
+			mid[j][c] = (a + b) / 2;
+		}
+	}
+	double volume = 0;
+	double moment[3] = {};
+	for (int z = low[2]; z < high[2]; z++) {
+		for (int y = low[1]; y < high[1]; y++) {
+			for (int x = low[0]; x < high[0]; x++) {
+				float fill = cells.fill[(z * CELLS + y) * CELLS + x];
+				if (fill == 0) {
+					continue;
+				}
+				double v = static_cast<double>(fill) * length[0][x] * length[1][y] * length[2][z];
+				volume += v;
+				moment[0] += v * mid[0][x];
+				moment[1] += v * mid[1][y];
+				moment[2] += v * mid[2][z];
+			}
+		}
+	}
+	if (centre != nullptr && volume > 0) {
+		*centre = Point(static_cast<float>(moment[0] / volume), static_cast<float>(moment[1] / volume),
+			static_cast<float>(moment[2] / volume));
+	}
+	return static_cast<float>(volume);
 }
 
-bool Object::contains(Point p) {
-	// calculate volume
-	float temp = 0;
-	for (Triangle v : polygones) {
-		temp += abs(tetrahedron_volume(p, v));
+float Object::cell_edge(int axis, int i) const {
+	if (i == Volume_grid::CELLS) {
+		return bounds.second[axis];
 	}
-	return is_zero(temp - real_volume);
+	return bounds.first[axis] + i * ((bounds.second[axis] - bounds.first[axis]) / Volume_grid::CELLS);
 }
 
-CrossType Object::cross(Box limit) {
-	std::vector<Point> limit_points = limit.get_points();
-	Object limit_obj = limit;
-	bool in = true;
-	for (Point v : limit_points) {
-		if (!contains(v)) {
-			in = false;
+void Object::fill_cells(Box const& box, int const* first, int const* last, std::vector<int> const& near,
+	std::vector<float>& fill) const {
+	const int CELLS = Volume_grid::CELLS;
+	int axis = 0;
+	for (int j = 1; j < 3; j++) {
+		if (last[j] - first[j] > last[axis] - first[axis]) {
+			axis = j;
 		}
 	}
-	if (in) {
-		return LIMIT_IN_OBJ;
+	if (last[axis] - first[axis] == 1) {
+		fill[(first[2] * CELLS + first[1]) * CELLS + first[0]] = contains(sample_point(box)) ? 1.0f : 0.0f;
+		return;
+	}
+	std::vector<int> overlap;
+	CrossType type = cross(box, near, overlap);
+	if (type == EMPTY_INTERSECTION) {
+		return;
 	}
-	bool out = true;
-	for (Point tpoint : points) {
-		if (!limit_obj.contains(tpoint)) {
-			out = false;
+	if (type == LIMIT_IN_OBJ) {
+		for (int z = first[2]; z < last[2]; z++) {
+			for (int y = first[1]; y < last[1]; y++) {
+				for (int x = first[0]; x < last[0]; x++) {
+					fill[(z * CELLS + y) * CELLS + x] = 1;
+				}
+			}
 		}
+		return;
 	}
-	if (out) {
-		return OBJ_IN_LIMIT;
+	int split = (first[axis] + last[axis]) / 2;
+	Box halves[2] = { box, box };
+	halves[0].second[axis] = cell_edge(axis, split);
+	halves[1].first[axis] = cell_edge(axis, split);
+	int half_last[3] = { last[0], last[1], last[2] };
+	int half_first[3] = { first[0], first[1], first[2] };
+	half_last[axis] = split;
+	half_first[axis] = split;
+	fill_cells(halves[0], first, half_last, overlap, fill);
+	fill_cells(halves[1], half_first, last, overlap, fill);
+}
+
+void Object::candidates(Box limit, std::vector<int>& result) const {
+	QT_COUNT(CANDIDATE_QUERIES, 1);
+	bvh->query(limit, result);
+}
+
+CrossType Object::cross(Box limit) const {
+	std::vector<int> candidates(mesh.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		candidates[i] = static_cast<int>(i);
 	}
-	for (Triangle v : limit_obj) {
-		for (Triangle u : polygones) {
-			if (cross_triangle_triangle(v, u)) {
-				return INTERSECTION;
+	std::vector<int> overlap;
+	return cross(limit, candidates, overlap);
+}
+
+CrossType Object::cross(Box limit, std::vector<int> const& candidates, std::vector<int>& overlap) const {
+	QT_COUNT(CROSS_CALLS, 1);
+	overlap.clear();
+	Triangle_packet packet;
+	uint8_t hit[Triangle_packet::SIZE];
+	for (size_t first = 0; first < candidates.size(); first += Triangle_packet::SIZE) {
+		size_t last = std::min(candidates.size(), first + Triangle_packet::SIZE);
+		packet.size = 0;
+		for (size_t i = first; i < last; i++) {
+			add_to_packet(packet, mesh, candidates[i]);
+		}
+		cross_box_triangles(limit, packet, hit);
+		for (size_t i = first; i < last; i++) {
+			if (hit[i - first]) {
+				overlap.push_back(candidates[i]);
 			}
 		}
 	}
-	return EMPTY_INTERSECTION;
+	if (overlap.empty()) {
+		// no surface inside limit, so its centre decides for the whole box
+		return contains((limit.first + limit.second) / 2) ? LIMIT_IN_OBJ : EMPTY_INTERSECTION;
+	}
+	if (limit.contains(bounds.first) && limit.contains(bounds.second)) {
+		return OBJ_IN_LIMIT;
+	}
+	return INTERSECTION;
 }
 
 Point operator+(Point a, Point b) {
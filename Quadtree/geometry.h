@@ -1,5 +1,8 @@
 #pragma once
+#include <cstdint>
+#include <memory>
 #include <vector>
+#include "simd.h"
 
 bool is_zero(float x);
 
@@ -13,7 +16,7 @@ struct Point {
 
 	Point(float _x, float _y, float _z);
 	Point();
-	Point(Point const& b) : Point(b.x, b.y, b.z) { }
+	Point(Point const& b) = default;
 
 	friend Point operator+(Point a, Point b);
 	friend Point operator-(Point a, Point b);
@@ -33,22 +36,46 @@ struct Point {
 Point cross_product(Point a, Point b);
 float dot_product(Point a, Point b);
 
+// structure-of-arrays list of points for the batched queries
+struct Point_batch {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	Point_batch();
+	explicit Point_batch(std::vector<Point> const& points);
+
+	void push_back(Point p);
+	size_t size() const;
+	Point operator[](size_t i) const;
+};
+
 struct Triangle {
 	typedef Point* iterator;
-	union {
-		struct {
-			Point a, b, c;
-		};
-
-		Point points[3];
-	};
+	// Point has constructors, so it can't sit in an anonymous struct of a
+	// union outside MSVC; the corners are reached by index only
+	Point points[3];
 
+	Triangle();
 	Triangle(Point a, Point b, Point c);
-	Triangle(Triangle const& b);
+	Triangle(Triangle const& b) = default;
+	Triangle& operator=(Triangle const& b) = default;
 
 	iterator begin();
 	iterator end();
-	Point operator[](size_t x);
+	Point operator[](size_t x) const;
+};
+
+// Triangles over shared vertices. The vertices are a structure of arrays
+// and triangle i is vertices[indices[3 * i]], [3 * i + 1], [3 * i + 2],
+// about a third of the memory of the same triangles stored by value.
+struct Indexed_mesh {
+	Point_batch vertices;
+	std::vector<uint32_t> indices;
+
+	size_t size() const;
+	Point corner(size_t triangle, int k) const;
+	Triangle triangle(size_t i) const;
 };
 
 struct Interval {
@@ -56,29 +83,49 @@ struct Interval {
 	float max;
 };
 
-Interval get_interval(Triangle triangle, Point axis);
-bool overlap_on_axis(Triangle t1, Triangle t2, Point axis);
-bool cross_triangle_triangle(Triangle t1, Triangle t2);
+Interval get_interval(Triangle const& triangle, Point axis);
+bool overlap_on_axis(Triangle const& t1, Triangle const& t2, Point axis);
+bool cross_triangle_triangle(Triangle const& t1, Triangle const& t2);
 
 struct Box {
-	union {
-		struct {
-			Point first, second;
-		};
-		Point data[2];
-	};
+	Point first, second;
 
+	Box();
 	Box(Point first, Point second);
-	Box(Box const& b) {
-		data[0] = b.data[0];
-		data[1] = b.data[1];
-	}
+	Box(Box const& b) = default;
+	Box& operator=(Box const& b) = default;
 	bool contains(Point x) const;
 	std::vector<Point> get_points() const;
 };
 
+// separating axis test of a triangle against an axis-aligned box,
+// only touching the boundary of the box is not an overlap
+bool cross_triangle_box(Triangle const& t, Box const& box);
+
+// The same tests for a whole packet at once on the best instruction set
+// of the CPU, result[i] is the scalar answer for packet triangle i.
+void add_to_packet(Triangle_packet& packet, Triangle const& t);
+void add_to_packet(Triangle_packet& packet, Indexed_mesh const& mesh, size_t triangle);
+void cross_triangle_triangles(Triangle const& t, Triangle_packet const& packet, uint8_t* result);
+void cross_box_triangles(Box const& box, Triangle_packet const& packet, uint8_t* result);
+
 float tetrahedron_volume(Point a, Point b, Point c, Point d);
-float tetrahedron_volume(Point a, Triangle tr);
+float tetrahedron_volume(Point a, Triangle const& tr);
+
+// rotation (or any linear map) followed by a shift
+struct Transform {
+	float rotation[3][3];
+	Point shift;
+
+	Transform();
+	static Transform translation(Point shift);
+
+	Point apply(Point p) const;
+};
+
+class Triangle_bvh;
+class Thread_pool;
+struct Volume_grid;
 
 enum CrossType {
 	LIMIT_IN_OBJ,
@@ -88,20 +135,50 @@ enum CrossType {
 };
 
 class Object {
-	std::vector<Triangle> polygones;
-	std::vector<Point> points;
-	float real_volume;
-
+	Indexed_mesh mesh;
+	Box bounds;
+	float volume;
+	// shared between copies, the triangles never change after init
+	std::shared_ptr<Triangle_bvh const> bvh;
+	// filled by the first volume_in, also shared
+	std::shared_ptr<Volume_grid> grid;
+
+	void init(std::vector<Triangle> const& triangles, Thread_pool* pool = nullptr);
 	void init();
+	float cell_edge(int axis, int i) const;
+	// box spans the cells [first, last) of the grid along every axis
+	void fill_cells(Box const& box, int const* first, int const* last, std::vector<int> const& near,
+		std::vector<float>& fill) const;
 public:
-	typedef std::vector<Triangle>::iterator iterator;
-	iterator begin();
-	iterator end();
-
 	Object(const std::vector<Point>& points, std::vector<std::vector<int> > connect);
 	Object(const std::vector<Triangle>& trianguals);
+	// with a pool the vertices are welded in parallel
+	Object(std::vector<Triangle> const& trianguals, Thread_pool* pool);
+	Object(Indexed_mesh mesh);
 	Object(Box trianguals);
 
-	bool contains(Point p);
-	CrossType cross(Box limit);
+	// moves every vertex, the bounds and the hierarchy are rebuilt
+	void transform(Transform const& t);
+
+	size_t size() const;
+	Triangle triangle(size_t i) const;
+	Indexed_mesh const& get_mesh() const;
+	Box get_bounds() const;
+	// enclosed by the surface, the triangles must be oriented alike
+	float get_volume() const;
+
+	bool contains(Point p) const;
+	// The part of the volume inside limit. The bounds are cut into 16
+	// cells along every axis, a cell is inside or outside as cross
+	// classifies it, or by one point in it when the surface crosses it,
+	// and limit gets the share of every cell it overlaps. So the parts of
+	// a box add up to the box. centre, when given, gets the centroid of
+	// the volume found.
+	float volume_in(Box const& limit, Point* centre = nullptr) const;
+	// triangles whose bounding boxes touch limit, a superset of the ones crossing it
+	void candidates(Box limit, std::vector<int>& result) const;
+	CrossType cross(Box limit) const;
+	// only the triangles in candidates are tested, the ones touching limit
+	// are written to overlap and are the candidates for its sub-boxes
+	CrossType cross(Box limit, std::vector<int> const& candidates, std::vector<int>& overlap) const;
 };
@@ -0,0 +1,124 @@
+#include "grid_sampler.h"
+#include "thread_pool.h"
+#include <algorithm>
+
+Grid::Grid() :
+	origin(),
+	step(),
+	count() { }
+
+Grid::Grid(Point origin, Point step, int nx, int ny, int nz) :
+	origin(origin),
+	step(step) {
+	count[0] = nx;
+	count[1] = ny;
+	count[2] = nz;
+}
+
+Point Grid::at(int i, int j, int k) const {
+	return Point(origin.x + i * step.x, origin.y + j * step.y, origin.z + k * step.z);
+}
+
+size_t Grid::size() const {
+	return static_cast<size_t>(count[0]) * count[1] * count[2];
+}
+
+Grid_view::Grid_view() :
+	data(nullptr),
+	stride(),
+	component(1) { }
+
+Grid_view::Grid_view(float* data, ptrdiff_t sx, ptrdiff_t sy, ptrdiff_t sz, ptrdiff_t component) :
+	data(data),
+	component(component) {
+	stride[0] = sx;
+	stride[1] = sy;
+	stride[2] = sz;
+}
+
+Grid_view Grid_view::dense(float* data, Grid const& grid, int components) {
+	ptrdiff_t sx = components;
+	ptrdiff_t sy = sx * grid.count[0];
+	ptrdiff_t sz = sy * grid.count[1];
+	return Grid_view(data, sx, sy, sz, 1);
+}
+
+Grid_settings::Grid_settings() :
+	tile(4),
+	threads(0) { }
+
+Grid_sampler::Grid_sampler(Physical_quadtree const& tree, Grid_settings const& settings, Thread_pool* pool) :
+	tree(tree),
+	settings(settings),
+	pool(pool) {
+	if (pool == nullptr && settings.threads != 1) {
+		own_pool.reset(new Thread_pool(settings.threads));
+		this->pool = own_pool.get();
+	}
+}
+
+Grid_sampler::~Grid_sampler() { }
+
+void Grid_sampler::sample_tile(Grid const& grid, int const* first, int const* last,
+	Physical_quadtree::Interaction_list& list, Grid_view const& field, Grid_view const& potential) const {
+	Box bounds(grid.at(first[0], first[1], first[2]), grid.at(last[0] - 1, last[1] - 1, last[2] - 1));
+	for (int j = 0; j < 3; j++) {
+		// a negative step puts the last sample below the first
+		if (bounds.first[j] > bounds.second[j]) {
+			std::swap(bounds.first[j], bounds.second[j]);
+		}
+	}
+	tree.interactions(bounds, list);
+	for (int k = first[2]; k < last[2]; k++) {
+		for (int j = first[1]; j < last[1]; j++) {
+			for (int i = first[0]; i < last[0]; i++) {
+				Point e;
+				float phi;
+				tree.field_at(grid.at(i, j, k), list, e, phi);
+				if (field.data != nullptr) {
+					float* out = field.data + i * field.stride[0] + j * field.stride[1] + k * field.stride[2];
+					out[0] = e.x;
+					out[field.component] = e.y;
+					out[2 * field.component] = e.z;
+				}
+				if (potential.data != nullptr) {
+					potential.data[i * potential.stride[0] + j * potential.stride[1] + k * potential.stride[2]] = phi;
+				}
+			}
+		}
+	}
+}
+
+void Grid_sampler::sample(Grid const& grid, Grid_view const& field, Grid_view const& potential) const {
+	if (grid.size() == 0) {
+		return;
+	}
+	int side = std::max(settings.tile, 1);
+	int tiles[3];
+	for (int j = 0; j < 3; j++) {
+		tiles[j] = (grid.count[j] + side - 1) / side;
+	}
+	size_t count = static_cast<size_t>(tiles[0]) * tiles[1] * tiles[2];
+	auto run = [&](size_t from, size_t to) {
+		Physical_quadtree::Interaction_list list;
+		for (size_t t = from; t < to; t++) {
+			int index[3] = {
+				static_cast<int>(t % tiles[0]),
+				static_cast<int>(t / tiles[0] % tiles[1]),
+				static_cast<int>(t / tiles[0] / tiles[1])
+			};
+			int first[3];
+			int last[3];
+			for (int j = 0; j < 3; j++) {
+				first[j] = index[j] * side;
+				last[j] = std::min(first[j] + side, grid.count[j]);
+			}
+			sample_tile(grid, first, last, list, field, potential);
+		}
+	};
+	if (pool == nullptr) {
+		run(0, count);
+		return;
+	}
+	pool->parallel_for(count, 1, run);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include "geometry.h"
+#include "physical_quadtree.h"
+
+// samples origin + (i * step.x, j * step.y, k * step.z) for i < count[0],
+// j < count[1], k < count[2]
+struct Grid {
+	Grid();
+	Grid(Point origin, Point step, int nx, int ny, int nz);
+
+	Point origin;
+	Point step;
+	int count[3];
+
+	Point at(int i, int j, int k) const;
+	size_t size() const;
+};
+
+// Where the samples of a grid go in a caller's buffer: sample (i, j, k)
+// starts at data + i * stride[0] + j * stride[1] + k * stride[2] and the
+// components of a vector follow each other component floats apart.
+struct Grid_view {
+	Grid_view();
+	Grid_view(float* data, ptrdiff_t sx, ptrdiff_t sy, ptrdiff_t sz, ptrdiff_t component = 1);
+	// x fastest and the components of a sample next to each other
+	static Grid_view dense(float* data, Grid const& grid, int components);
+
+	float* data;  // nullptr skips this output
+	ptrdiff_t stride[3];
+	ptrdiff_t component;
+};
+
+struct Grid_settings {
+	Grid_settings();
+
+	int tile;     // samples along each side of a tile
+	int threads;  // 1 samples serially, 0 uses every hardware thread
+};
+
+// Field and potential of a Physical_quadtree on a regular grid. The grid
+// is cut into tiles that run in parallel. A tile walks the tree once for
+// its bounds and every sample in it sums the same interaction list, so a
+// sample costs a pass over a short list instead of a walk of its own.
+class Grid_sampler {
+	Physical_quadtree const& tree;
+	Grid_settings settings;
+	std::unique_ptr<Thread_pool> own_pool;
+	Thread_pool* pool;  // nullptr samples serially
+
+	void sample_tile(Grid const& grid, int const* first, int const* last, Physical_quadtree::Interaction_list& list,
+		Grid_view const& field, Grid_view const& potential) const;
+
+public:
+	// the tiles run on pool, or unless settings.threads is 1 on a pool
+	// the sampler makes once and keeps for every call
+	Grid_sampler(Physical_quadtree const& tree, Grid_settings const& settings = Grid_settings(),
+		Thread_pool* pool = nullptr);
+	~Grid_sampler();
+
+	// writes E (3 components) to field and the potential to potential,
+	// the buffers are the caller's and must hold every sample of grid
+	void sample(Grid const& grid, Grid_view const& field, Grid_view const& potential) const;
+};
@@ -0,0 +1,498 @@
+#include "job_runner.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include "grid_sampler.h"
+#include "mesh_loader.h"
+#include "output_writer.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+namespace {
+bool fail(std::string* error, std::string const& message) {
+	if (error != nullptr) {
+		*error = message;
+	}
+	return false;
+}
+
+// runs the trace of a job until it is written or the job gives up
+class Trace_scope {
+	bool running = false;
+
+public:
+	Trace_scope() = default;
+	Trace_scope(Trace_scope const&) = delete;
+	Trace_scope& operator=(Trace_scope const&) = delete;
+	~Trace_scope() {
+		stop();
+	}
+
+	void start() {
+		reset_stats();
+		start_trace();
+		running = true;
+	}
+	void stop() {
+		if (running) {
+			stop_trace();
+			running = false;
+		}
+	}
+};
+
+bool to_float(std::string const& s, float& value) {
+	char* end = nullptr;
+	errno = 0;
+	value = strtof(s.c_str(), &end);
+	return !s.empty() && *end == 0 && errno == 0;
+}
+
+bool to_int(std::string const& s, int& value) {
+	char* end = nullptr;
+	errno = 0;
+	long v = strtol(s.c_str(), &end, 10);
+	value = static_cast<int>(v);
+	return !s.empty() && *end == 0 && errno == 0 && v == value;
+}
+
+bool parse_format(std::string const& name, OutputFormat& format) {
+	if (name == "text") {
+		format = TEXT_OUTPUT;
+	}
+	else if (name == "binary") {
+		format = BINARY_OUTPUT;
+	}
+	else if (name == "vtk") {
+		format = VTK_OUTPUT;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+bool ends_with(std::string const& s, char const* suffix) {
+	std::string tail(suffix);
+	return s.size() >= tail.size() && s.compare(s.size() - tail.size(), tail.size(), tail) == 0;
+}
+
+// n points, m triangles as 1-based point indices
+bool read_text_mesh(std::string const& path, std::vector<Triangle>& triangles, std::string* error) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		return fail(error, "can't open " + path);
+	}
+	int n = 0;
+	int m = 0;
+	in >> n >> m;
+	std::vector<Point> points(n > 0 ? n : 0);
+	for (Point& p : points) {
+		in >> p.x >> p.y >> p.z;
+	}
+	triangles.clear();
+	for (int i = 0; i < m && in; i++) {
+		int index[3];
+		in >> index[0] >> index[1] >> index[2];
+		Triangle t;
+		for (int j = 0; j < 3; j++) {
+			if (index[j] < 1 || index[j] > n) {
+				return fail(error, path + ": triangle " + std::to_string(i + 1) + " has no point "
+					+ std::to_string(index[j]));
+			}
+			t.points[j] = points[index[j] - 1];
+		}
+		triangles.push_back(t);
+	}
+	if (!in || n < 0 || m < 0) {
+		return fail(error, path + " is truncated or damaged");
+	}
+	return true;
+}
+
+std::string tree_key(std::vector<Object_spec> const& objects, Job const& job) {
+	std::string key;
+	char number[64];
+	for (Object_spec const& spec : objects) {
+		snprintf(number, sizeof(number), "%.9g", spec.charge);
+		key += spec.mesh + '\n' + number + '\n';
+	}
+	for (int j = 0; j < 3; j++) {
+		snprintf(number, sizeof(number), "%.9g %.9g ", job.domain.first[j], job.domain.second[j]);
+		key += number;
+	}
+	return key + std::to_string(job.max_height);
+}
+
+// the objects of the job, input.txt with charge 5 when none are given
+std::vector<Object_spec> job_objects(Job const& job) {
+	std::vector<Object_spec> objects = job.objects;
+	if (objects.empty()) {
+		objects.push_back(Object_spec{ "input.txt", DEFAULT_CHARGE });
+	}
+	return objects;
+}
+
+// FNV-1a of tree_key and of the size and modification time of every
+// mesh, a snapshot saved under another key is not of this job
+uint64_t snapshot_key(std::vector<Object_spec> const& objects, Job const& job) {
+	std::string key = tree_key(objects, job);
+	for (Object_spec const& spec : objects) {
+		std::error_code ignored;
+		uintmax_t size = std::filesystem::file_size(spec.mesh, ignored);
+		auto time = std::filesystem::last_write_time(spec.mesh, ignored).time_since_epoch().count();
+		key += '\n' + std::to_string(size) + ' ' + std::to_string(time);
+	}
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : key) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// E and the potential on a grid spanning the domain
+bool write_field(Physical_quadtree const& tree, Job const& job, Output_writer& output, std::string* error) {
+	Grid grid;
+	grid.origin = job.domain.first;
+	for (int j = 0; j < 3; j++) {
+		grid.count[j] = job.field[j];
+		float size = job.domain.second[j] - job.domain.first[j];
+		grid.step[j] = job.field[j] > 1 ? size / (job.field[j] - 1) : 0;
+		if (job.field[j] == 1) {
+			grid.origin[j] += size / 2;
+		}
+	}
+	Grid_settings settings;
+	settings.threads = job.threads;
+	Grid_sampler sampler(tree, settings);
+	// a slab of tiles at a time, the writer stores one while the next is
+	// sampled; the potential goes after all of E, so its slabs wait in a
+	// temporary file instead of a buffer of the whole grid
+	std::unique_ptr<FILE, int (*)(FILE*)> spill(tmpfile(), fclose);
+	if (spill == nullptr) {
+		return fail(error, "can't create a temporary file for the potential");
+	}
+	size_t layer = static_cast<size_t>(grid.count[0]) * grid.count[1];
+	std::vector<float> field(layer * 3 * settings.tile);
+	std::vector<float> potential(layer * settings.tile);
+	output.begin_field("E", grid, 3);
+	for (int k = 0; k < grid.count[2]; k += settings.tile) {
+		Grid slab = grid;
+		slab.origin = grid.at(0, 0, k);
+		slab.count[2] = std::min(settings.tile, grid.count[2] - k);
+		sampler.sample(slab, Grid_view::dense(field.data(), slab, 3), Grid_view::dense(potential.data(), slab, 1));
+		output.write_samples(field.data(), slab.size());
+		if (fwrite(potential.data(), sizeof(float), slab.size(), spill.get()) != slab.size()) {
+			return fail(error, "can't write the potential to a temporary file");
+		}
+	}
+	rewind(spill.get());
+	output.begin_field("potential", grid, 1);
+	for (size_t left = grid.size(); left > 0;) {
+		size_t count = std::min(left, potential.size());
+		if (fread(potential.data(), sizeof(float), count, spill.get()) != count) {
+			return fail(error, "can't read the potential back from a temporary file");
+		}
+		output.write_samples(potential.data(), count);
+		left -= count;
+	}
+	return true;
+}
+}
+
+Job::Job() :
+	domain(Point(-10, -10, -10), Point(10, 10, 10)),
+	max_height(Build_settings().max_height),
+	theta(0.5f),
+	threads(0),
+	zones(true),
+	occupancy(10),
+	output("output.txt") {
+	field[0] = field[1] = field[2] = 0;
+}
+
+bool parse_job(std::vector<std::string> const& args, Job& job, std::string* error) {
+	bool own_objects = false;
+	for (size_t i = 0; i < args.size(); i++) {
+		std::string const& flag = args[i];
+		// whether count more arguments follow the flag
+		auto values = [&](size_t count) {
+			return i + count < args.size();
+		};
+		auto bad = [&](std::string const& what) {
+			return fail(error, flag + " needs " + what);
+		};
+		if (flag == "--mesh") {
+			if (!values(1)) {
+				return bad("a path");
+			}
+			if (!own_objects) {
+				job.objects.clear();
+				own_objects = true;
+			}
+			job.objects.push_back(Object_spec{ args[++i], DEFAULT_CHARGE });
+		}
+		else if (flag == "--charge") {
+			if (job.objects.empty() || !own_objects) {
+				return fail(error, "--charge has to follow the --mesh it is for");
+			}
+			if (!values(1) || !to_float(args[++i], job.objects.back().charge)) {
+				return bad("a number");
+			}
+		}
+		else if (flag == "--domain") {
+			if (!values(6)) {
+				return bad("6 numbers");
+			}
+			Box domain;
+			for (int j = 0; j < 6; j++) {
+				if (!to_float(args[++i], (j < 3 ? domain.first : domain.second)[j % 3])) {
+					return bad("6 numbers");
+				}
+			}
+			for (int j = 0; j < 3; j++) {
+				if (!(domain.first[j] < domain.second[j])) {
+					return fail(error, "--domain needs the lower corner first");
+				}
+			}
+			job.domain = domain;
+		}
+		else if (flag == "--depth") {
+			if (!values(1) || !to_int(args[++i], job.max_height) || job.max_height < 0) {
+				return bad("a height of at least 0");
+			}
+		}
+		else if (flag == "--theta") {
+			if (!values(1) || !to_float(args[++i], job.theta) || !(job.theta > 0)) {
+				return bad("a positive number");
+			}
+		}
+		else if (flag == "--threads") {
+			if (!values(1) || !to_int(args[++i], job.threads)) {
+				return bad("a number");
+			}
+		}
+		else if (flag == "--snapshot") {
+			if (!values(1)) {
+				return bad("a path");
+			}
+			job.snapshot = args[++i];
+		}
+		else if (flag == "--zones") {
+			job.zones = true;
+		}
+		else if (flag == "--no-zones") {
+			job.zones = false;
+		}
+		else if (flag == "--occupancy") {
+			if (!values(1) || !to_int(args[++i], job.occupancy) || job.occupancy < 0) {
+				return bad("a count of at least 0");
+			}
+		}
+		else if (flag == "--field") {
+			int count[3];
+			if (!values(1) || !to_int(args[++i], count[0]) || count[0] < 0) {
+				return bad("1 or 3 counts of at least 0");
+			}
+			count[1] = count[2] = count[0];
+			// a second number means all three are given
+			int second;
+			if (values(1) && to_int(args[i + 1], second)) {
+				count[1] = second;
+				if (!values(2) || !to_int(args[i + 2], count[2]) || count[1] < 0 || count[2] < 0) {
+					return bad("1 or 3 counts of at least 0");
+				}
+				i += 2;
+			}
+			for (int j = 0; j < 3; j++) {
+				job.field[j] = count[j];
+			}
+		}
+		else if (flag == "--output") {
+			if (!values(1)) {
+				return bad("a path");
+			}
+			job.output = args[++i];
+		}
+		else if (flag == "--trace") {
+			if (!values(1)) {
+				return bad("a path");
+			}
+			job.trace = args[++i];
+		}
+		else if (flag == "--format") {
+			OutputFormat format;
+			if (!values(1) || !parse_format(args[++i], format)) {
+				return bad("text, binary or vtk");
+			}
+			job.format = args[i];
+		}
+		else {
+			return fail(error, "unknown flag " + flag);
+		}
+	}
+	return true;
+}
+
+bool read_jobs(std::string const& path, Job const& defaults, std::vector<Job>& jobs, std::string* error) {
+	std::ifstream in(path.c_str());
+	if (!in) {
+		return fail(error, "can't open " + path);
+	}
+	std::string line;
+	for (int number = 1; std::getline(in, line); number++) {
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::vector<std::string> args;
+		for (std::string word; words >> word; ) {
+			args.push_back(word);
+		}
+		if (args.empty()) {
+			continue;
+		}
+		Job job = defaults;
+		std::string message;
+		if (!parse_job(args, job, &message)) {
+			return fail(error, path + ':' + std::to_string(number) + ": " + message);
+		}
+		jobs.push_back(std::move(job));
+	}
+	return true;
+}
+
+Job_runner::Job_runner(size_t cached_trees) :
+	cached_trees(cached_trees) { }
+
+bool Job_runner::load(std::string const& path, int threads, Object const*& object, std::string* error) {
+	auto found = meshes.find(path);
+	if (found == meshes.end()) {
+		std::vector<Triangle> triangles;
+		Thread_pool pool(threads);
+		bool ok = ends_with(path, ".txt") ? read_text_mesh(path, triangles, error) :
+			read_mesh(path, triangles, pool, error);
+		if (!ok) {
+			return false;
+		}
+		found = meshes.insert(std::make_pair(path, Object(triangles, &pool))).first;
+	}
+	object = &found->second;
+	return true;
+}
+
+bool Job_runner::find_tree(Job const& job, Tree*& tree, std::string* error) {
+	std::vector<Object_spec> objects = job_objects(job);
+	std::string key = tree_key(objects, job);
+	for (auto it = trees.begin(); it != trees.end(); ++it) {
+		if (it->key == key) {
+			trees.splice(trees.begin(), trees, it);
+			tree = &trees.front();
+			return true;
+		}
+	}
+	std::vector<PObject> scene_objects;
+	for (Object_spec const& spec : objects) {
+		Object const* object;
+		if (!load(spec.mesh, job.threads, object, error)) {
+			return false;
+		}
+		scene_objects.push_back(PObject(*object, spec.charge));
+	}
+	Build_settings settings;
+	settings.threads = job.threads;
+	settings.max_height = job.max_height;
+	trees.emplace_front();
+	Tree& made = trees.front();
+	made.key = key;
+	made.scene.reset(new Scene(std::move(scene_objects)));
+	made.tree.reset(new Physical_quadtree(*made.scene, job.domain, job.theta, settings));
+	// the tree just made stays even with no room for any
+	while (trees.size() > 1 && trees.size() > cached_trees) {
+		trees.pop_back();
+	}
+	tree = &made;
+	return true;
+}
+
+bool Job_runner::run(Job const& job, std::string* error) {
+	Output_settings settings;
+	settings.format = output_format(job.output);
+	if (!job.format.empty() && !parse_format(job.format, settings.format)) {
+		return fail(error, "unknown output format " + job.format);
+	}
+	bool field = job.field[0] > 0 && job.field[1] > 0 && job.field[2] > 0;
+	bool flat_queries = job.zones || job.occupancy > 0;
+	Trace_scope trace;
+	if (!job.trace.empty()) {
+		if (!stats_compiled_in()) {
+			return fail(error, "--trace needs a build with QUADTREE_STATS");
+		}
+		trace.start();
+	}
+
+	// a snapshot stands in for the tree as long as no field is asked for
+	// and it was saved for the same objects, mesh files, domain and depth;
+	// otherwise the tree is built and the snapshot written again
+	uint64_t key = job.snapshot.empty() ? 0 : snapshot_key(job_objects(job), job);
+	std::unique_ptr<Flat_quadtree<Phy_node> > loaded;
+	if (!job.snapshot.empty() && !field) {
+		loaded = Flat_quadtree<Phy_node>::load(job.snapshot);
+		if (loaded != nullptr && loaded->get_key() != key) {
+			loaded.reset();
+		}
+	}
+	Flat_quadtree<Phy_node> const* flat = loaded.get();
+	Tree* tree = nullptr;
+	if (flat == nullptr && (flat_queries || field || !job.snapshot.empty())) {
+		if (!find_tree(job, tree, error)) {
+			return false;
+		}
+		tree->tree->set_theta(job.theta);
+		if (flat_queries || !job.snapshot.empty()) {
+			if (tree->flat == nullptr) {
+				tree->flat.reset(new Flat_quadtree<Phy_node>(*tree->tree));
+			}
+			tree->flat->set_key(key);
+			flat = tree->flat.get();
+			if (!job.snapshot.empty() && !flat->save(job.snapshot, error)) {
+				return false;
+			}
+		}
+	}
+
+	std::unique_ptr<Output_writer> output = open_output(job.output, settings, error);
+	if (output == nullptr) {
+		return false;
+	}
+	if (job.zones) {
+		output->write_zones(flat->get_zones());
+	}
+	if (job.occupancy > 0) {
+		int n = job.occupancy;
+		Grid grid(Point(0, 0, 0), Point(1, 1, 1), n, n, n);
+		output->begin_field("occupied", grid, 1);
+		std::vector<float> slice(static_cast<size_t>(n) * n);
+		for (int k = 0; k < n; k++) {
+			for (int j = 0; j < n; j++) {
+				for (int i = 0; i < n; i++) {
+					slice[j * n + i] = !flat->is_empty_point(grid.at(i, j, k));
+				}
+			}
+			output->write_samples(slice.data(), slice.size());
+		}
+	}
+	if (field && !write_field(*tree->tree, job, *output, error)) {
+		return false;
+	}
+	if (!output->close(error)) {
+		return false;
+	}
+	if (!job.trace.empty()) {
+		trace.stop();
+		return write_trace(job.trace, error);
+	}
+	return true;
+}
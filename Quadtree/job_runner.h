@@ -0,0 +1,87 @@
+#pragma once
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "flat_quadtree.h"
+#include "geometry.h"
+#include "physical_quadtree.h"
+#include "scene.h"
+
+// the charge of an object no --charge is given for, as the driver has
+// always used
+const float DEFAULT_CHARGE = 5;
+
+struct Object_spec {
+	std::string mesh;  // OBJ, STL, PLY or the old input.txt format (.txt)
+	float charge;
+};
+
+// One run of the driver: the scene, the tree to build on it, what to ask
+// the tree and where to write the answers.
+struct Job {
+	Job();
+
+	std::vector<Object_spec> objects;  // none reads input.txt with DEFAULT_CHARGE
+	Box domain;
+	int max_height;
+	float theta;
+	int threads;           // for loading, building and sampling, 0 uses every hardware thread
+	std::string snapshot;  // a Flat_quadtree snapshot, loaded if it can be, written otherwise
+
+	bool zones;
+	int occupancy;         // samples (i, j, k) for i, j, k < occupancy, 0 for none
+	int field[3];          // samples of E and the potential per side of the domain, 0 for none
+
+	std::string output;
+	std::string format;    // text, binary or vtk, empty picks by the extension of output
+	std::string trace;     // Chrome trace of the build, needs QUADTREE_STATS
+};
+
+// Applies flags to job, later flags win:
+//   --mesh path         adds an object, the first --mesh drops the objects job had
+//   --charge q          charge of the last --mesh, 5 by default
+//   --domain x0 y0 z0 x1 y1 z1
+//   --depth n           Build_settings::max_height
+//   --theta t
+//   --threads n
+//   --snapshot path
+//   --zones / --no-zones
+//   --occupancy n
+//   --field n | --field nx ny nz
+//   --output path
+//   --format text|binary|vtk
+//   --trace path        a tree taken from the cache is not built, its trace is empty
+// On failure returns false and describes the problem in error.
+bool parse_job(std::vector<std::string> const& args, Job& job, std::string* error = nullptr);
+
+// A job file holds a job per line, written as the flags of parse_job and
+// applied to defaults. # starts a comment, blank lines are skipped.
+bool read_jobs(std::string const& path, Job const& defaults, std::vector<Job>& jobs, std::string* error = nullptr);
+
+// Runs jobs one after another in one process. Meshes are parsed once and
+// kept for every later job. The trees of the last few jobs are kept too,
+// a job with the same objects, charges, domain and depth reuses one
+// instead of building it again.
+class Job_runner {
+	struct Tree {
+		std::string key;
+		std::unique_ptr<Scene> scene;
+		std::unique_ptr<Physical_quadtree> tree;
+		std::unique_ptr<Flat_quadtree<Phy_node> > flat;  // made from tree when first asked for
+	};
+
+	std::map<std::string, Object> meshes;
+	std::list<Tree> trees;  // most recently used first
+	size_t cached_trees;
+
+	bool load(std::string const& path, int threads, Object const*& object, std::string* error);
+	bool find_tree(Job const& job, Tree*& tree, std::string* error);
+
+public:
+	explicit Job_runner(size_t cached_trees = 4);
+
+	// describes the failure in error, the runner can go on with other jobs
+	bool run(Job const& job, std::string* error = nullptr);
+};
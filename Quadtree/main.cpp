@@ -1,51 +1,61 @@
-#define _CRT_SECURE_NO_DEPRECATE
 #include <iostream>
-#include <cmath>
-#include <cassert>
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
 #include <vector>
-#include "physical_quadtree.h"
-#include "geometry.h"
+#include "job_runner.h"
 
 using namespace std;
 
-int main() {
-	freopen("input.txt", "r", stdin);
-	freopen("output.txt", "w", stdout);
-	vector<PObject> objects;
-	int n, m;
-	cin >> n >> m;
-	vector<Point> points(n);
-	for (int i = 0; i < n; i++) {
-		cin >> points[i].x >> points[i].y >> points[i].z;
-	}
-	vector<vector<int> > connections(m, vector<int>(3));
-	for (int i = 0; i < m; i++) {
-		for (int j = 0; j < 3; j++) {
-			cin >> connections[i][j];
-			connections[i][j]--;
+// main [--jobs file] [--cache n] [job flags]
+// Runs the job the flags describe (see parse_job), or with --jobs every
+// line of the file on top of them. The trees of the last n jobs, 4 by
+// default, are kept for later jobs. Without flags input.txt is read and
+// its zones and occupancy are written to output.txt.
+int main(int argc, char* argv[]) {
+	string jobs_path;
+	size_t cache = 4;
+	vector<string> flags;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--jobs" && i + 1 < argc) {
+			jobs_path = argv[++i];
+		}
+		else if (arg == "--cache" && i + 1 < argc) {
+			cache = static_cast<size_t>(max(atoi(argv[++i]), 0));
+		}
+		else {
+			flags.push_back(arg);
 		}
 	}
-	Object object(points, connections);
-	int MAX = 10;
-	Box limit(Point(-MAX, -MAX, -MAX), Point(MAX, MAX, MAX));
-	objects.push_back(PObject(object, 5));
-	Physical_quadtree quadtree(objects, limit);
-	auto zone = quadtree.get_zones();
-	cout << zone.size() << '\n';
-	for (auto v : zone) {
-		auto s = (v.second + v.first) / 2;
-		auto d = (v.second - v.first) / 2;
-		cout << s.x << ' ' << s.y << ' ' << s.z << ' ' << d.x << ' ' << d.y << ' ' << d.z << '\n';
+	string error;
+	Job defaults;
+	if (!parse_job(flags, defaults, &error)) {
+		cerr << error << '\n';
+		return 1;
 	}
-	int T = MAX * MAX * MAX;
-	cout << T << '\n';
-	for (int i = 0; i < MAX; i++) {
-		for (int j = 0; j < MAX; j++) {
-			for (int k = 0; k < MAX; k++) {
-				int ok = !quadtree.is_empty_point(Point(i, j, k));
-				cout << i << ' ' << j << ' ' << k << ' ' << ok << '\n';
-			}
+	vector<Job> jobs;
+	if (jobs_path.empty()) {
+		jobs.push_back(defaults);
+	}
+	else if (!read_jobs(jobs_path, defaults, jobs, &error)) {
+		cerr << error << '\n';
+		return 1;
+	}
+	Job_runner runner(cache);
+	int failed = 0;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		auto start = chrono::steady_clock::now();
+		bool ok = runner.run(jobs[i], &error);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (!ok) {
+			cerr << "job " << i + 1 << ": " << error << '\n';
+			failed++;
+		}
+		else if (jobs.size() > 1) {
+			cerr << "job " << i + 1 << ": " << jobs[i].output << " in " << seconds << " s\n";
 		}
 	}
+	return failed == 0 ? 0 : 1;
 }
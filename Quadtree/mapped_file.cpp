@@ -0,0 +1,113 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+Mapped_file::Mapped_file(std::string const& path) :
+	bytes(nullptr),
+	length(0),
+	file(INVALID_HANDLE_VALUE),
+	mapping(nullptr) {
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		return;
+	}
+	length = static_cast<size_t>(size.QuadPart);
+	if (length == 0) {
+		return;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr) {
+		bytes = static_cast<char const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (bytes == nullptr) {
+		length = 0;
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+}
+
+Mapped_file::~Mapped_file() {
+	if (bytes != nullptr) {
+		UnmapViewOfFile(bytes);
+	}
+	if (mapping != nullptr) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+}
+
+bool Mapped_file::is_open() const {
+	return file != INVALID_HANDLE_VALUE;
+}
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Mapped_file::Mapped_file(std::string const& path) :
+	bytes(nullptr),
+	length(0),
+	file(-1) {
+	file = open(path.c_str(), O_RDONLY);
+	if (file < 0) {
+		return;
+	}
+	struct stat info;
+	if (fstat(file, &info) != 0) {
+		close(file);
+		file = -1;
+		return;
+	}
+	length = static_cast<size_t>(info.st_size);
+	if (length == 0) {
+		return;
+	}
+	void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+	if (mapped == MAP_FAILED) {
+		length = 0;
+		close(file);
+		file = -1;
+		return;
+	}
+	bytes = static_cast<char const*>(mapped);
+	madvise(mapped, length, MADV_SEQUENTIAL);
+}
+
+Mapped_file::~Mapped_file() {
+	if (bytes != nullptr) {
+		munmap(const_cast<char*>(bytes), length);
+	}
+	if (file >= 0) {
+		close(file);
+	}
+}
+
+bool Mapped_file::is_open() const {
+	return file >= 0;
+}
+#endif
+
+char const* Mapped_file::data() const {
+	return bytes;
+}
+
+size_t Mapped_file::size() const {
+	return length;
+}
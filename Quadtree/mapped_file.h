@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+class Mapped_file {
+	char const* bytes;
+	size_t length;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int file;
+#endif
+
+public:
+	explicit Mapped_file(std::string const& path);
+	~Mapped_file();
+
+	Mapped_file(Mapped_file const&) = delete;
+	Mapped_file& operator=(Mapped_file const&) = delete;
+
+	// false if the file could not be opened or mapped, an empty file is valid
+	bool is_open() const;
+	char const* data() const;
+	size_t size() const;
+};
@@ -0,0 +1,940 @@
+#include "mesh_loader.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+	// bytes of text handed to one parse task
+	const size_t TEXT_CHUNK = 1 << 20;
+	// records of a binary file handed to one parse task
+	const size_t RECORD_CHUNK = 1 << 15;
+
+	bool fail(std::string* error, std::string const& message) {
+		if (error != nullptr) {
+			*error = message;
+		}
+		return false;
+	}
+
+	bool host_little_endian() {
+		uint16_t one = 1;
+		unsigned char first;
+		memcpy(&first, &one, 1);
+		return first == 1;
+	}
+
+	// a piece of a mapped text file, the scanners never rely on a terminating zero
+	struct Text_range {
+		char const* first;
+		char const* last;
+	};
+
+	// cuts [first, last) into pieces of about size bytes ending at line breaks
+	std::vector<Text_range> split_lines(char const* first, char const* last, size_t size) {
+		std::vector<Text_range> ranges;
+		while (first < last) {
+			char const* cut = last;
+			if (static_cast<size_t>(last - first) > size) {
+				cut = static_cast<char const*>(memchr(first + size, '\n', last - first - size));
+				cut = cut == nullptr ? last : cut + 1;
+			}
+			ranges.push_back({ first, cut });
+			first = cut;
+		}
+		return ranges;
+	}
+
+	// calls f(begin, end) for every line of range, without the line break
+	template<typename F>
+	void for_each_line(Text_range range, F f) {
+		char const* line = range.first;
+		while (line < range.last) {
+			char const* stop = static_cast<char const*>(memchr(line, '\n', range.last - line));
+			if (stop == nullptr) {
+				stop = range.last;
+			}
+			f(line, stop);
+			line = stop < range.last ? stop + 1 : range.last;
+		}
+	}
+
+	bool is_blank(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	bool is_digit(char c) {
+		return static_cast<unsigned>(c - '0') < 10;
+	}
+
+	char const* skip_blanks(char const* p, char const* end) {
+		while (p < end && is_blank(*p)) {
+			p++;
+		}
+		return p;
+	}
+
+	char const* skip_word(char const* p, char const* end) {
+		while (p < end && !is_blank(*p)) {
+			p++;
+		}
+		return p;
+	}
+
+	size_t count_words(char const* p, char const* end) {
+		size_t words = 0;
+		for (p = skip_blanks(p, end); p < end; p = skip_blanks(skip_word(p, end), end)) {
+			words++;
+		}
+		return words;
+	}
+
+	// moves p past word if it is the next one on the line
+	bool take_word(char const*& p, char const* end, char const* word) {
+		char const* q = skip_blanks(p, end);
+		size_t length = strlen(word);
+		if (static_cast<size_t>(end - q) < length || memcmp(q, word, length) != 0) {
+			return false;
+		}
+		q += length;
+		if (q < end && !is_blank(*q)) {
+			return false;
+		}
+		p = q;
+		return true;
+	}
+
+	double power_of_ten(int e) {
+		static const double exact[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		return e <= 22 ? exact[e] : std::pow(10.0, e);
+	}
+
+	bool parse_float(char const*& p, char const* end, float& value) {
+		char const* q = skip_blanks(p, end);
+		bool negative = false;
+		if (q < end && (*q == '-' || *q == '+')) {
+			negative = *q == '-';
+			q++;
+		}
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+		for (; q < end && is_digit(*q); q++, digits++) {
+			if (mantissa < 100000000000000000ull) {
+				mantissa = mantissa * 10 + (*q - '0');
+			}
+			else {
+				exponent++;
+			}
+		}
+		if (q < end && *q == '.') {
+			for (q++; q < end && is_digit(*q); q++, digits++) {
+				if (mantissa < 100000000000000000ull) {
+					mantissa = mantissa * 10 + (*q - '0');
+					exponent--;
+				}
+			}
+		}
+		if (digits == 0) {
+			return false;
+		}
+		if (q < end && (*q == 'e' || *q == 'E')) {
+			char const* r = q + 1;
+			bool minus = false;
+			if (r < end && (*r == '-' || *r == '+')) {
+				minus = *r == '-';
+				r++;
+			}
+			if (r < end && is_digit(*r)) {
+				int e = 0;
+				for (; r < end && is_digit(*r); r++) {
+					if (e < 10000) {
+						e = e * 10 + (*r - '0');
+					}
+				}
+				exponent += minus ? -e : e;
+				q = r;
+			}
+		}
+		double result = static_cast<double>(mantissa);
+		if (exponent > 0) {
+			result *= power_of_ten(exponent);
+		}
+		else if (exponent < 0) {
+			result /= power_of_ten(-exponent);
+		}
+		value = static_cast<float>(negative ? -result : result);
+		p = q;
+		return true;
+	}
+
+	bool parse_int(char const*& p, char const* end, long long& value) {
+		char const* q = skip_blanks(p, end);
+		bool negative = false;
+		if (q < end && (*q == '-' || *q == '+')) {
+			negative = *q == '-';
+			q++;
+		}
+		if (q == end || !is_digit(*q)) {
+			return false;
+		}
+		long long result = 0;
+		for (; q < end && is_digit(*q); q++) {
+			result = result * 10 + (*q - '0');
+		}
+		value = negative ? -result : result;
+		p = q;
+		return true;
+	}
+
+	bool parse_point(char const*& p, char const* end, Point& point) {
+		return parse_float(p, end, point.x) && parse_float(p, end, point.y) && parse_float(p, end, point.z);
+	}
+
+	struct Obj_counts {
+		size_t vertices;
+		size_t triangles;
+	};
+
+	// 'v' for a vertex, 'f' for a face and 0 for every other statement
+	char obj_statement(char const*& p, char const* end) {
+		if (take_word(p, end, "v")) {
+			return 'v';
+		}
+		if (take_word(p, end, "f")) {
+			return 'f';
+		}
+		return 0;
+	}
+
+	bool read_obj(Mapped_file const& file, std::vector<Triangle>& triangles, Thread_pool& pool, std::string* error) {
+		std::vector<Text_range> ranges = split_lines(file.data(), file.data() + file.size(), TEXT_CHUNK);
+
+		// pass 1: vertices and fan triangles per range, their prefix sums are
+		// where every range writes, so the next passes need no merging
+		std::vector<Obj_counts> offsets(ranges.size() + 1, Obj_counts{ 0, 0 });
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			for (size_t r = first; r < last; r++) {
+				Obj_counts& own = offsets[r + 1];
+				for_each_line(ranges[r], [&](char const* p, char const* stop) {
+					char kind = obj_statement(p, stop);
+					if (kind == 'v') {
+						own.vertices++;
+					}
+					else if (kind == 'f') {
+						size_t corners = count_words(p, stop);
+						own.triangles += corners >= 3 ? corners - 2 : 0;
+					}
+				});
+			}
+		});
+		for (size_t r = 0; r < ranges.size(); r++) {
+			offsets[r + 1].vertices += offsets[r].vertices;
+			offsets[r + 1].triangles += offsets[r].triangles;
+		}
+
+		// pass 2: vertices
+		std::vector<Point> vertices(offsets.back().vertices);
+		std::atomic<bool> bad_vertex(false);
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			for (size_t r = first; r < last; r++) {
+				size_t next = offsets[r].vertices;
+				for_each_line(ranges[r], [&](char const* p, char const* stop) {
+					if (obj_statement(p, stop) == 'v' && !parse_point(p, stop, vertices[next++])) {
+						bad_vertex = true;
+					}
+				});
+			}
+		});
+		if (bad_vertex) {
+			return fail(error, "malformed vertex");
+		}
+
+		// pass 3: faces, relative indices count back from the vertices seen so far
+		triangles.assign(offsets.back().triangles, Triangle());
+		std::atomic<bool> bad_face(false);
+		long long total = static_cast<long long>(vertices.size());
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			for (size_t r = first; r < last; r++) {
+				long long seen = static_cast<long long>(offsets[r].vertices);
+				size_t next = offsets[r].triangles;
+				for_each_line(ranges[r], [&](char const* p, char const* stop) {
+					char kind = obj_statement(p, stop);
+					if (kind == 'v') {
+						seen++;
+						return;
+					}
+					if (kind != 'f' || count_words(p, stop) < 3) {
+						return;
+					}
+					long long fan[2];
+					int corners = 0;
+					long long index;
+					while (parse_int(p, stop, index)) {
+						// drop the texture and normal references of v/vt/vn
+						p = skip_word(p, stop);
+						index = index > 0 ? index - 1 : seen + index;
+						if (index < 0 || index >= total) {
+							bad_face = true;
+							return;
+						}
+						if (corners >= 2) {
+							triangles[next++] = Triangle(vertices[fan[0]], vertices[fan[1]], vertices[index]);
+							fan[1] = index;
+						}
+						else {
+							fan[corners] = index;
+						}
+						corners++;
+					}
+					if (skip_blanks(p, stop) != stop) {
+						bad_face = true;
+					}
+				});
+			}
+		});
+		if (bad_face) {
+			return fail(error, "malformed face or vertex index out of range");
+		}
+		return true;
+	}
+
+	const size_t STL_HEADER = 84;
+	const size_t STL_RECORD = 50;
+
+	float read_float(char const* p, bool swap) {
+		unsigned char bytes[4];
+		memcpy(bytes, p, 4);
+		if (swap) {
+			std::reverse(bytes, bytes + 4);
+		}
+		float value;
+		memcpy(&value, bytes, 4);
+		return value;
+	}
+
+	Point read_point(char const* p, bool swap) {
+		return Point(read_float(p, swap), read_float(p + 4, swap), read_float(p + 8, swap));
+	}
+
+	bool read_binary_stl(Mapped_file const& file, size_t count, std::vector<Triangle>& triangles, Thread_pool& pool) {
+		bool swap = !host_little_endian();
+		char const* records = file.data() + STL_HEADER;
+		triangles.assign(count, Triangle());
+		pool.parallel_for(count, RECORD_CHUNK, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				// a record is the normal, three corners and an attribute word
+				char const* p = records + i * STL_RECORD;
+				triangles[i] = Triangle(read_point(p + 12, swap), read_point(p + 24, swap), read_point(p + 36, swap));
+			}
+		});
+		return true;
+	}
+
+	bool read_ascii_stl(Mapped_file const& file, std::vector<Triangle>& triangles, Thread_pool& pool, std::string* error) {
+		std::vector<Text_range> ranges = split_lines(file.data(), file.data() + file.size(), TEXT_CHUNK);
+		std::vector<size_t> offsets(ranges.size() + 1, 0);
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			for (size_t r = first; r < last; r++) {
+				for_each_line(ranges[r], [&](char const* p, char const* stop) {
+					if (take_word(p, stop, "vertex")) {
+						offsets[r + 1]++;
+					}
+				});
+			}
+		});
+		for (size_t r = 0; r < ranges.size(); r++) {
+			offsets[r + 1] += offsets[r];
+		}
+		if (offsets.back() % 3 != 0) {
+			return fail(error, "facet without three vertices");
+		}
+
+		triangles.assign(offsets.back() / 3, Triangle());
+		std::atomic<bool> bad_vertex(false);
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			for (size_t r = first; r < last; r++) {
+				size_t next = offsets[r];
+				for_each_line(ranges[r], [&](char const* p, char const* stop) {
+					if (take_word(p, stop, "vertex")) {
+						if (!parse_point(p, stop, triangles[next / 3].points[next % 3])) {
+							bad_vertex = true;
+						}
+						next++;
+					}
+				});
+			}
+		});
+		if (bad_vertex) {
+			return fail(error, "malformed vertex");
+		}
+		return true;
+	}
+
+	bool read_stl(Mapped_file const& file, std::vector<Triangle>& triangles, Thread_pool& pool, std::string* error) {
+		// binary files may also start with "solid", so the size decides first
+		if (file.size() >= STL_HEADER) {
+			uint32_t count;
+			memcpy(&count, file.data() + 80, 4);
+			if (!host_little_endian()) {
+				count = (count >> 24) | ((count >> 8) & 0xff00) | ((count << 8) & 0xff0000) | (count << 24);
+			}
+			if (file.size() == STL_HEADER + STL_RECORD * static_cast<size_t>(count)) {
+				return read_binary_stl(file, count, triangles, pool);
+			}
+		}
+		// "solid" opens the first line that is not blank, the name after it is optional
+		char const* end = file.data() + file.size();
+		char const* p = file.data();
+		while (p < end && (is_blank(*p) || *p == '\n')) {
+			p++;
+		}
+		char const* stop = static_cast<char const*>(memchr(p, '\n', end - p));
+		if (take_word(p, stop == nullptr ? end : stop, "solid")) {
+			return read_ascii_stl(file, triangles, pool, error);
+		}
+		return fail(error, "neither a binary nor an ASCII STL file");
+	}
+
+	enum Ply_type {
+		PLY_INT8,
+		PLY_UINT8,
+		PLY_INT16,
+		PLY_UINT16,
+		PLY_INT32,
+		PLY_UINT32,
+		PLY_FLOAT32,
+		PLY_FLOAT64,
+		PLY_UNKNOWN
+	};
+
+	enum Ply_format {
+		PLY_ASCII,
+		PLY_LITTLE_ENDIAN,
+		PLY_BIG_ENDIAN
+	};
+
+	struct Ply_property {
+		std::string name;
+		Ply_type type;
+		// type of the length prefix, PLY_UNKNOWN for a scalar property
+		Ply_type count_type;
+	};
+
+	struct Ply_element {
+		std::string name;
+		size_t count;
+		std::vector<Ply_property> properties;
+	};
+
+	struct Ply_header {
+		Ply_format format;
+		std::vector<Ply_element> elements;
+		char const* body;
+	};
+
+	Ply_type ply_type(std::string const& name) {
+		static const char* const names[][2] = {
+			{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+			{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+		};
+		for (int i = 0; i < PLY_UNKNOWN; i++) {
+			if (name == names[i][0] || name == names[i][1]) {
+				return static_cast<Ply_type>(i);
+			}
+		}
+		return PLY_UNKNOWN;
+	}
+
+	size_t ply_size(Ply_type type) {
+		static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+		return sizes[type];
+	}
+
+	double ply_value(char const* p, Ply_type type, bool swap) {
+		unsigned char bytes[8];
+		size_t size = ply_size(type);
+		memcpy(bytes, p, size);
+		if (swap) {
+			std::reverse(bytes, bytes + size);
+		}
+		switch (type) {
+		case PLY_INT8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+		case PLY_UINT8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+		case PLY_INT16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+		case PLY_UINT16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+		case PLY_INT32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+		case PLY_UINT32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+		case PLY_FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+		default: { double v; memcpy(&v, bytes, 8); return v; }
+		}
+	}
+
+	bool is_list(Ply_property const& property) {
+		return property.count_type != PLY_UNKNOWN;
+	}
+
+	bool is_face_list(Ply_property const& property) {
+		return is_list(property) && (property.name == "vertex_indices" || property.name == "vertex_index");
+	}
+
+	std::vector<std::string> split_words(char const* p, char const* end) {
+		std::vector<std::string> words;
+		for (p = skip_blanks(p, end); p < end; p = skip_blanks(p, end)) {
+			char const* stop = skip_word(p, end);
+			words.push_back(std::string(p, stop));
+			p = stop;
+		}
+		return words;
+	}
+
+	bool read_ply_header(Mapped_file const& file, Ply_header& header, std::string* error) {
+		char const* p = file.data();
+		char const* end = p + file.size();
+		bool magic = true;
+		bool has_format = false;
+		while (p < end) {
+			char const* stop = static_cast<char const*>(memchr(p, '\n', end - p));
+			if (stop == nullptr) {
+				return fail(error, "PLY header without end_header");
+			}
+			std::vector<std::string> words = split_words(p, stop);
+			p = stop + 1;
+			if (magic) {
+				if (words.size() != 1 || words[0] != "ply") {
+					return fail(error, "not a PLY file");
+				}
+				magic = false;
+			}
+			else if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+				continue;
+			}
+			else if (words[0] == "format" && words.size() >= 2) {
+				if (words[1] == "ascii") {
+					header.format = PLY_ASCII;
+				}
+				else if (words[1] == "binary_little_endian") {
+					header.format = PLY_LITTLE_ENDIAN;
+				}
+				else if (words[1] == "binary_big_endian") {
+					header.format = PLY_BIG_ENDIAN;
+				}
+				else {
+					return fail(error, "unknown PLY format " + words[1]);
+				}
+				has_format = true;
+			}
+			else if (words[0] == "element" && words.size() == 3) {
+				char* count_end;
+				unsigned long long count = strtoull(words[2].c_str(), &count_end, 10);
+				if (*count_end != 0) {
+					return fail(error, "malformed PLY element " + words[1]);
+				}
+				header.elements.push_back(Ply_element{ words[1], static_cast<size_t>(count), {} });
+			}
+			else if (words[0] == "property" && !header.elements.empty()) {
+				Ply_property property;
+				if (words.size() == 5 && words[1] == "list") {
+					property = Ply_property{ words[4], ply_type(words[3]), ply_type(words[2]) };
+					if (property.count_type == PLY_UNKNOWN) {
+						return fail(error, "unknown PLY type " + words[2]);
+					}
+				}
+				else if (words.size() == 3) {
+					property = Ply_property{ words[2], ply_type(words[1]), PLY_UNKNOWN };
+				}
+				else {
+					return fail(error, "malformed PLY property");
+				}
+				if (property.type == PLY_UNKNOWN) {
+					return fail(error, "unknown PLY type in property " + property.name);
+				}
+				header.elements.back().properties.push_back(property);
+			}
+			else if (words[0] == "end_header") {
+				header.body = p;
+				return has_format ? true : fail(error, "PLY header without format");
+			}
+			else {
+				return fail(error, "unknown PLY header line " + words[0]);
+			}
+		}
+		return fail(error, "PLY header without end_header");
+	}
+
+	// walks over one binary record and returns its end, nullptr past end;
+	// the corners of the face list are appended to corners if it is given
+	char const* walk_binary_record(Ply_element const& element, char const* p, char const* end, bool swap,
+			std::vector<long long>* corners) {
+		for (Ply_property const& property : element.properties) {
+			size_t count = 1;
+			if (is_list(property)) {
+				if (static_cast<size_t>(end - p) < ply_size(property.count_type)) {
+					return nullptr;
+				}
+				count = static_cast<size_t>(ply_value(p, property.count_type, swap));
+				p += ply_size(property.count_type);
+			}
+			size_t size = count * ply_size(property.type);
+			if (static_cast<size_t>(end - p) < size) {
+				return nullptr;
+			}
+			if (corners != nullptr && is_face_list(property)) {
+				for (size_t i = 0; i < count; i++) {
+					corners->push_back(static_cast<long long>(ply_value(p + i * ply_size(property.type), property.type, swap)));
+				}
+			}
+			p += size;
+		}
+		return p;
+	}
+
+	// appends the fan of corners, false if an index is out of range
+	bool add_fan(std::vector<long long> const& corners, std::vector<Point> const& vertices, Triangle* out) {
+		for (long long index : corners) {
+			if (index < 0 || index >= static_cast<long long>(vertices.size())) {
+				return false;
+			}
+		}
+		for (size_t i = 2; i < corners.size(); i++) {
+			*out++ = Triangle(vertices[corners[0]], vertices[corners[i - 1]], vertices[corners[i]]);
+		}
+		return true;
+	}
+
+	bool read_binary_ply(Mapped_file const& file, Ply_header const& header, std::vector<Triangle>& triangles,
+			Thread_pool& pool, std::string* error) {
+		bool swap = (header.format == PLY_LITTLE_ENDIAN) != host_little_endian();
+		char const* p = header.body;
+		char const* end = file.data() + file.size();
+		std::vector<Point> vertices;
+		bool has_vertices = false;
+		for (Ply_element const& element : header.elements) {
+			// fixed layout of the record, valid while it has no lists
+			size_t stride = 0;
+			size_t lists = 0;
+			size_t offset[3] = { 0, 0, 0 };
+			Ply_type type[3] = { PLY_UNKNOWN, PLY_UNKNOWN, PLY_UNKNOWN };
+			for (Ply_property const& property : element.properties) {
+				if (is_list(property)) {
+					lists++;
+					continue;
+				}
+				for (int axis = 0; axis < 3; axis++) {
+					if (property.name == std::string(1, static_cast<char>('x' + axis))) {
+						offset[axis] = stride;
+						type[axis] = property.type;
+					}
+				}
+				stride += ply_size(property.type);
+			}
+
+			if (element.name == "vertex") {
+				if (lists != 0 || type[0] == PLY_UNKNOWN || type[1] == PLY_UNKNOWN || type[2] == PLY_UNKNOWN) {
+					return fail(error, "PLY vertex needs scalar x, y and z");
+				}
+				if (static_cast<size_t>(end - p) / stride < element.count) {
+					return fail(error, "PLY file is truncated");
+				}
+				vertices.resize(element.count);
+				pool.parallel_for(element.count, RECORD_CHUNK, [&](size_t first, size_t last) {
+					for (size_t i = first; i < last; i++) {
+						char const* record = p + i * stride;
+						for (int axis = 0; axis < 3; axis++) {
+							vertices[i][axis] = static_cast<float>(ply_value(record + offset[axis], type[axis], swap));
+						}
+					}
+				});
+				p += element.count * stride;
+				has_vertices = true;
+			}
+			else if (element.name == "face") {
+				if (!has_vertices) {
+					return fail(error, "PLY faces before vertices");
+				}
+				size_t list = element.properties.size();
+				size_t before = 0;
+				for (size_t i = 0; i < element.properties.size(); i++) {
+					if (is_face_list(element.properties[i])) {
+						list = i;
+						break;
+					}
+					before += is_list(element.properties[i]) ? 0 : ply_size(element.properties[i].type);
+				}
+				if (list == element.properties.size()) {
+					return fail(error, "PLY face without vertex_indices");
+				}
+				Ply_property const& indices = element.properties[list];
+
+				// Meshes are nearly always pure triangles. Then every record has
+				// the same size, which is checked in parallel by reading all
+				// the counts at that stride, and the faces are read in parallel.
+				size_t record = stride + ply_size(indices.count_type) + 3 * ply_size(indices.type);
+				bool triangulated = lists == 1 && static_cast<size_t>(end - p) / record >= element.count;
+				if (triangulated) {
+					std::atomic<bool> other(false);
+					pool.parallel_for(element.count, RECORD_CHUNK, [&](size_t first, size_t last) {
+						for (size_t i = first; i < last && !other; i++) {
+							if (ply_value(p + i * record + before, indices.count_type, swap) != 3) {
+								other = true;
+							}
+						}
+					});
+					triangulated = !other;
+				}
+				if (triangulated) {
+					size_t base = triangles.size();
+					triangles.resize(base + element.count, Triangle());
+					std::atomic<bool> bad_face(false);
+					pool.parallel_for(element.count, RECORD_CHUNK, [&](size_t first, size_t last) {
+						std::vector<long long> corners(3);
+						for (size_t i = first; i < last; i++) {
+							char const* corner = p + i * record + before + ply_size(indices.count_type);
+							for (int k = 0; k < 3; k++) {
+								corners[k] = static_cast<long long>(ply_value(corner + k * ply_size(indices.type), indices.type, swap));
+							}
+							if (!add_fan(corners, vertices, &triangles[base + i])) {
+								bad_face = true;
+							}
+						}
+					});
+					if (bad_face) {
+						return fail(error, "PLY vertex index out of range");
+					}
+					p += element.count * record;
+				}
+				else {
+					std::vector<long long> corners;
+					for (size_t i = 0; i < element.count; i++) {
+						corners.clear();
+						p = walk_binary_record(element, p, end, swap, &corners);
+						if (p == nullptr) {
+							return fail(error, "PLY file is truncated");
+						}
+						if (corners.size() >= 3) {
+							size_t base = triangles.size();
+							triangles.resize(base + corners.size() - 2, Triangle());
+							if (!add_fan(corners, vertices, &triangles[base])) {
+								return fail(error, "PLY vertex index out of range");
+							}
+						}
+					}
+				}
+			}
+			else if (lists == 0) {
+				if (static_cast<size_t>(end - p) / std::max<size_t>(stride, 1) < element.count) {
+					return fail(error, "PLY file is truncated");
+				}
+				p += element.count * stride;
+			}
+			else {
+				for (size_t i = 0; i < element.count && p != nullptr; i++) {
+					p = walk_binary_record(element, p, end, swap, nullptr);
+				}
+				if (p == nullptr) {
+					return fail(error, "PLY file is truncated");
+				}
+			}
+		}
+		return true;
+	}
+
+	// reads one ASCII record, the vertex position and the face list go to
+	// point and corners when they are given
+	bool read_ascii_record(Ply_element const& element, char const* p, char const* end, Point* point,
+			std::vector<long long>* corners) {
+		for (Ply_property const& property : element.properties) {
+			long long count = 1;
+			if (is_list(property) && !parse_int(p, end, count)) {
+				return false;
+			}
+			bool face = corners != nullptr && is_face_list(property);
+			for (long long i = 0; i < count; i++) {
+				float value;
+				if (face) {
+					long long index;
+					if (!parse_int(p, end, index)) {
+						return false;
+					}
+					corners->push_back(index);
+				}
+				else if (!parse_float(p, end, value)) {
+					return false;
+				}
+				else if (point != nullptr && !is_list(property) && property.name.size() == 1
+					&& property.name[0] >= 'x' && property.name[0] <= 'z') {
+					(*point)[property.name[0] - 'x'] = value;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool read_ascii_ply(Mapped_file const& file, Ply_header const& header, std::vector<Triangle>& triangles,
+			Thread_pool& pool, std::string* error) {
+		// every record is a line, so the line number tells the element
+		size_t vertex_line = 0;
+		size_t face_line = 0;
+		size_t vertex_count = 0;
+		size_t face_count = 0;
+		Ply_element const* vertex = nullptr;
+		Ply_element const* face = nullptr;
+		size_t line = 0;
+		for (Ply_element const& element : header.elements) {
+			if (element.name == "vertex") {
+				vertex = &element;
+				vertex_line = line;
+				vertex_count = element.count;
+			}
+			else if (element.name == "face") {
+				face = &element;
+				face_line = line;
+				face_count = element.count;
+			}
+			line += element.count;
+		}
+		if (vertex == nullptr) {
+			return fail(error, "PLY file without vertices");
+		}
+		if (face != nullptr && face_line < vertex_line) {
+			return fail(error, "PLY faces before vertices");
+		}
+
+		std::vector<Text_range> ranges = split_lines(header.body, file.data() + file.size(), TEXT_CHUNK);
+		std::vector<size_t> first_line(ranges.size() + 1, 0);
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			for (size_t r = first; r < last; r++) {
+				for_each_line(ranges[r], [&](char const*, char const*) {
+					first_line[r + 1]++;
+				});
+			}
+		});
+		for (size_t r = 0; r < ranges.size(); r++) {
+			first_line[r + 1] += first_line[r];
+		}
+		if (first_line.back() < line) {
+			return fail(error, "PLY file is truncated");
+		}
+
+		// vertices and the number of fan triangles in each range
+		std::vector<Point> vertices(vertex_count);
+		std::vector<size_t> offsets(ranges.size() + 1, 0);
+		std::atomic<bool> bad_record(false);
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			std::vector<long long> corners;
+			for (size_t r = first; r < last; r++) {
+				size_t at = first_line[r];
+				for_each_line(ranges[r], [&](char const* p, char const* stop) {
+					size_t i = at++;
+					if (i - vertex_line < vertex_count) {
+						if (!read_ascii_record(*vertex, p, stop, &vertices[i - vertex_line], nullptr)) {
+							bad_record = true;
+						}
+					}
+					else if (face != nullptr && i - face_line < face_count) {
+						corners.clear();
+						if (!read_ascii_record(*face, p, stop, nullptr, &corners)) {
+							bad_record = true;
+						}
+						offsets[r + 1] += corners.size() >= 3 ? corners.size() - 2 : 0;
+					}
+				});
+			}
+		});
+		if (bad_record) {
+			return fail(error, "malformed PLY record");
+		}
+		for (size_t r = 0; r < ranges.size(); r++) {
+			offsets[r + 1] += offsets[r];
+		}
+
+		triangles.assign(offsets.back(), Triangle());
+		std::atomic<bool> bad_face(false);
+		pool.parallel_for(ranges.size(), 1, [&](size_t first, size_t last) {
+			std::vector<long long> corners;
+			for (size_t r = first; r < last; r++) {
+				size_t at = first_line[r];
+				size_t next = offsets[r];
+				for_each_line(ranges[r], [&](char const* p, char const* stop) {
+					size_t i = at++;
+					if (face == nullptr || i - face_line >= face_count) {
+						return;
+					}
+					corners.clear();
+					read_ascii_record(*face, p, stop, nullptr, &corners);
+					if (corners.size() < 3) {
+						return;
+					}
+					if (!add_fan(corners, vertices, &triangles[next])) {
+						bad_face = true;
+					}
+					next += corners.size() - 2;
+				});
+			}
+		});
+		if (bad_face) {
+			return fail(error, "PLY vertex index out of range");
+		}
+		return true;
+	}
+
+	bool read_ply(Mapped_file const& file, std::vector<Triangle>& triangles, Thread_pool& pool, std::string* error) {
+		Ply_header header;
+		if (!read_ply_header(file, header, error)) {
+			return false;
+		}
+		if (header.format == PLY_ASCII) {
+			return read_ascii_ply(file, header, triangles, pool, error);
+		}
+		return read_binary_ply(file, header, triangles, pool, error);
+	}
+
+	std::string extension(std::string const& path) {
+		size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos || path.find_first_of("/\\", dot) != std::string::npos) {
+			return "";
+		}
+		std::string result = path.substr(dot + 1);
+		for (char& c : result) {
+			c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+		}
+		return result;
+	}
+}
+
+bool read_mesh(std::string const& path, std::vector<Triangle>& triangles, Thread_pool& pool, std::string* error) {
+	triangles.clear();
+	std::string type = extension(path);
+	if (type != "obj" && type != "stl" && type != "ply") {
+		return fail(error, "unknown mesh format: " + path);
+	}
+	Mapped_file file(path);
+	if (!file.is_open()) {
+		return fail(error, "can't open " + path);
+	}
+	if (file.size() == 0) {
+		return type == "obj" ? true : fail(error, "empty file " + path);
+	}
+	bool done;
+	if (type == "obj") {
+		done = read_obj(file, triangles, pool, error);
+	}
+	else if (type == "stl") {
+		done = read_stl(file, triangles, pool, error);
+	}
+	else {
+		done = read_ply(file, triangles, pool, error);
+	}
+	if (!done) {
+		triangles.clear();
+	}
+	return done;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+class Thread_pool;
+
+// Reads the triangles of an OBJ, STL (binary or ASCII) or PLY (ASCII or
+// binary) file, the format is picked by the extension. The file is mapped
+// into memory and parsed in parallel on pool straight into triangles,
+// polygons are split into fans. An Object welds them into its mesh.
+// On failure returns false and describes the problem in error.
+bool read_mesh(std::string const& path, std::vector<Triangle>& triangles, Thread_pool& pool,
+	std::string* error = nullptr);
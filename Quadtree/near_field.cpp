@@ -0,0 +1,155 @@
+#include "near_field.h"
+#include <algorithm>
+#include <cmath>
+
+const float MIN_DISTANCE = 1e-6f;
+
+namespace {
+	// a triangle closer than this many times its longest edge is split in four
+	const float NEAR_SPLIT = 2;
+	const int MAX_SPLITS = 4;
+
+	// ln(a + r) for r = |(a, b, c)|, without the cancellation for a < 0;
+	// 0 at r = 0, a corner of the box, where every term it is in goes to 0
+	double log_plus(double a, double r) {
+		if (a >= 0) {
+			return r > 0 ? log(a + r) : 0;
+		}
+		double rest = r * r - a * a;
+		return rest > 0 ? log(rest / (r - a)) : 0;
+	}
+
+	double angle(double a, double b, double r) {
+		return b == 0 ? 0 : atan(a / (b * r));
+	}
+
+	// charge q spread evenly over t, by the three point rule once p is far
+	// enough from the triangle and by its four halves before that
+	void add_triangle(Point p, Triangle const& t, float q, int splits, Point& field, float& potential) {
+		Point c = (t.points[0] + t.points[1] + t.points[2]) / 3;
+		float size = 0;
+		for (int k = 0; k < 3; k++) {
+			Point edge = t.points[(k + 1) % 3] - t.points[k];
+			size = std::max(size, dot_product(edge, edge));
+		}
+		Point d = p - c;
+		if (splits < MAX_SPLITS && dot_product(d, d) < NEAR_SPLIT * NEAR_SPLIT * size) {
+			Point m[3];
+			for (int k = 0; k < 3; k++) {
+				m[k] = (t.points[k] + t.points[(k + 1) % 3]) / 2;
+			}
+			add_triangle(p, Triangle(t.points[0], m[0], m[2]), q / 4, splits + 1, field, potential);
+			add_triangle(p, Triangle(m[0], t.points[1], m[1]), q / 4, splits + 1, field, potential);
+			add_triangle(p, Triangle(m[2], m[1], t.points[2]), q / 4, splits + 1, field, potential);
+			add_triangle(p, Triangle(m[0], m[1], m[2]), q / 4, splits + 1, field, potential);
+			return;
+		}
+		for (int k = 0; k < 3; k++) {
+			Point at = t.points[k] * (2.0f / 3) + (t.points[(k + 1) % 3] + t.points[(k + 2) % 3]) / 6;
+			add_charge_field(p, at, q / 3, field, potential);
+		}
+	}
+}
+
+// With x, y, z the corners of box relative to p, r = |(x, y, z)| and
+// the signs of an integral over the box,
+//   phi = sum xy ln(z + r) + yz ln(x + r) + zx ln(y + r)
+//         - x^2 / 2 atan(yz / xr) - y^2 / 2 atan(zx / yr) - z^2 / 2 atan(xy / zr)
+// per unit density, and E_x = sum y ln(z + r) + z ln(y + r) - x atan(yz / xr).
+void add_box_field(Point p, Box const& box, float q, Point& field, float& potential) {
+	double x[2] = { box.first.x - p.x, box.second.x - p.x };
+	double y[2] = { box.first.y - p.y, box.second.y - p.y };
+	double z[2] = { box.first.z - p.z, box.second.z - p.z };
+	double volume = (x[1] - x[0]) * (y[1] - y[0]) * (z[1] - z[0]);
+	if (volume == 0) {
+		return;
+	}
+	double phi = 0;
+	double e[3] = {};
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			for (int k = 0; k < 2; k++) {
+				double sign = (3 - i - j - k) % 2 ? -1 : 1;
+				double X = x[i];
+				double Y = y[j];
+				double Z = z[k];
+				double r = sqrt(X * X + Y * Y + Z * Z);
+				double lx = log_plus(X, r);
+				double ly = log_plus(Y, r);
+				double lz = log_plus(Z, r);
+				double ax = angle(Y * Z, X, r);
+				double ay = angle(Z * X, Y, r);
+				double az = angle(X * Y, Z, r);
+				phi += sign * (X * Y * lz + Y * Z * lx + Z * X * ly - (X * X * ax + Y * Y * ay + Z * Z * az) / 2);
+				e[0] += sign * (Y * lz + Z * ly - X * ax);
+				e[1] += sign * (Z * lx + X * lz - Y * ay);
+				e[2] += sign * (X * ly + Y * lx - Z * az);
+			}
+		}
+	}
+	double density = q / volume;
+	field = field + Point(static_cast<float>(e[0] * density), static_cast<float>(e[1] * density),
+		static_cast<float>(e[2] * density));
+	potential += static_cast<float>(phi * density);
+}
+
+void add_charge_field(Point p, Point at, float q, Point& field, float& potential) {
+	Point d = p - at;
+	float dist = sqrtf(dot_product(d, d));
+	if (dist < MIN_DISTANCE) {
+		return;
+	}
+	field = field + d * (q / (dist * dist * dist));
+	potential += q / dist;
+}
+
+void add_triangle_field(Point p, Triangle const& t, float q, Point& field, float& potential) {
+	add_triangle(p, t, q, 0, field, potential);
+}
+
+Near_sources::Near_sources(Scene const& scene, Box const& limit, bool full, float charge, Point centre) {
+	std::vector<Object_handle> handles;
+	scene.query(limit, handles);
+	std::vector<int> inside;
+	float surface = 0;
+	for (Object_handle id : handles) {
+		PObject const& object = scene.get(id);
+		if (!object.has_surface_charges()) {
+			// no object holds all of a surface leaf, those around it give 0
+			if (full) {
+				continue;
+			}
+			Point at = centre;
+			float share = charge;
+			if (handles.size() > 1) {
+				share = object.charge_in(limit, false, at);
+			}
+			if (share != 0) {
+				boxes.push_back(object.part_in(limit, false, at, share));
+				box_charges.push_back(share);
+			}
+			continue;
+		}
+		inside.clear();
+		object.surface_triangles_in(limit, inside);
+		for (int i : inside) {
+			triangles.push_back(object.triangle(i));
+			charges.push_back(object.get_surface_charges()[i]);
+			surface += charges.back();
+		}
+	}
+	// what a FULL payload holds beyond its triangles is spread through the box
+	if (full && charge != surface) {
+		boxes.push_back(limit);
+		box_charges.push_back(charge - surface);
+	}
+}
+
+void Near_sources::add_field(Point p, Point& field, float& potential) const {
+	for (size_t i = 0; i < boxes.size(); i++) {
+		add_box_field(p, boxes[i], box_charges[i], field, potential);
+	}
+	for (size_t i = 0; i < triangles.size(); i++) {
+		add_triangle_field(p, triangles[i], charges[i], field, potential);
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "scene.h"
+
+// Field and potential at p, in units with k = 1, of charge q spread
+// evenly through box, in closed form
+void add_box_field(Point p, Box const& box, float q, Point& field, float& potential);
+// of charge q spread evenly over t, by quadrature split finer the closer p
+void add_triangle_field(Point p, Triangle const& t, float q, Point& field, float& potential);
+void add_charge_field(Point p, Point at, float q, Point& field, float& potential);
+
+// The charges of a leaf of a tree, as a query close to the leaf sums
+// them directly: the volume charges spread through the box of a FULL
+// leaf and through the part PObject::part_in gives in a surface leaf,
+// and every surface triangle whose centroid is in the box.
+class Near_sources {
+	std::vector<Triangle> triangles;
+	std::vector<float> charges;
+	std::vector<Box> boxes;
+	std::vector<float> box_charges;
+
+public:
+	// charge and centre are the payload of the leaf, a leaf near a single
+	// volume charged object takes its part from them
+	Near_sources(Scene const& scene, Box const& limit, bool full, float charge, Point centre);
+
+	void add_field(Point p, Point& field, float& potential) const;
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Chunked allocator for objects of one type. Freed objects go to a free
+// list, reset() forgets everything at once and keeps the chunks, so a
+// pool reused for the next build never goes back to the system
+// allocator. create and destroy may be called from several threads:
+// every thread fills a chunk of its own and only takes the lock for the
+// next chunk, a slot of the free list or a destroy.
+template <class U>
+class Node_pool {
+	union slot {
+		slot* next;
+		alignas(U) unsigned char storage[sizeof(U)];
+	};
+
+	// the part of a chunk a thread has left, for the pool named owner
+	struct cursor {
+		uint64_t owner;
+		slot* next;
+		slot* end;
+	};
+	static std::atomic<uint64_t> next_id;
+	static thread_local cursor local;
+
+	std::vector<std::unique_ptr<slot[]> > chunks;
+	size_t chunk_size;
+	size_t next_chunk;  // the first chunk no thread has taken
+	slot* free_list;
+	std::atomic<size_t> alive;
+	// new on every reset, so the cursors into the old chunks are dropped
+	uint64_t id;
+	std::mutex lock;
+
+	slot* take();
+
+public:
+	explicit Node_pool(size_t chunk_size = 4096);
+
+	Node_pool(Node_pool const&) = delete;
+	Node_pool& operator=(Node_pool const&) = delete;
+
+	template <class... Args>
+	U* create(Args&&... args);
+	void destroy(U* v);
+
+	// drops every object without running destructors, while no other
+	// thread uses the pool
+	void reset();
+
+	size_t size() const;
+	size_t capacity() const;
+};
+
+template <class U>
+std::atomic<uint64_t> Node_pool<U>::next_id(1);
+
+template <class U>
+thread_local typename Node_pool<U>::cursor Node_pool<U>::local = { 0, nullptr, nullptr };
+
+template <class U>
+Node_pool<U>::Node_pool(size_t chunk_size) :
+	chunk_size(chunk_size == 0 ? 1 : chunk_size),
+	next_chunk(0),
+	free_list(nullptr),
+	alive(0),
+	id(next_id++) { }
+
+template <class U>
+typename Node_pool<U>::slot* Node_pool<U>::take() {
+	alive++;
+	cursor& mine = local;
+	if (mine.owner != id || mine.next == mine.end) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (free_list != nullptr) {
+			slot* result = free_list;
+			free_list = free_list->next;
+			return result;
+		}
+		if (next_chunk == chunks.size()) {
+			chunks.emplace_back(new slot[chunk_size]);
+		}
+		slot* first = chunks[next_chunk++].get();
+		mine = cursor{ id, first, first + chunk_size };
+	}
+	return mine.next++;
+}
+
+template <class U>
+template <class... Args>
+U* Node_pool<U>::create(Args&&... args) {
+	return new (take()->storage) U(std::forward<Args>(args)...);
+}
+
+template <class U>
+void Node_pool<U>::destroy(U* v) {
+	if (v == nullptr) {
+		return;
+	}
+	v->~U();
+	slot* cur = reinterpret_cast<slot*>(v);
+	std::lock_guard<std::mutex> guard(lock);
+	cur->next = free_list;
+	free_list = cur;
+	alive--;
+}
+
+template <class U>
+void Node_pool<U>::reset() {
+	std::lock_guard<std::mutex> guard(lock);
+	next_chunk = 0;
+	free_list = nullptr;
+	alive = 0;
+	id = next_id++;
+}
+
+template <class U>
+size_t Node_pool<U>::size() const {
+	return alive;
+}
+
+template <class U>
+size_t Node_pool<U>::capacity() const {
+	return chunks.size() * chunk_size;
+}
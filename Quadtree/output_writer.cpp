@@ -0,0 +1,547 @@
+#include "output_writer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace {
+bool fail(std::string* error, std::string const& message) {
+	if (error != nullptr) {
+		*error = message;
+	}
+	return false;
+}
+
+bool ends_with(std::string const& s, char const* suffix) {
+	size_t n = strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// centre and half-extents, as on a text line
+void zone_values(Box const& zone, float* out) {
+	Point centre = (zone.second + zone.first) / 2;
+	Point half = (zone.second - zone.first) / 2;
+	out[0] = centre.x;
+	out[1] = centre.y;
+	out[2] = centre.z;
+	out[3] = half.x;
+	out[4] = half.y;
+	out[5] = half.z;
+}
+
+// Writes n floats regrouped into 4 byte planes and run-length coded.
+// Returns false when that is no smaller than the floats themselves.
+bool pack(float const* values, size_t n, std::vector<uint8_t>& planes, std::vector<uint8_t>& out) {
+	size_t size = n * sizeof(float);
+	planes.resize(size);
+	uint8_t const* bytes = reinterpret_cast<uint8_t const*>(values);
+	for (size_t i = 0; i < n; i++) {
+		for (size_t b = 0; b < sizeof(float); b++) {
+			planes[b * n + i] = bytes[i * sizeof(float) + b];
+		}
+	}
+	out.clear();
+	size_t i = 0;
+	size_t literal = 0;  // start of the pending literal bytes
+	auto flush_literal = [&](size_t end) {
+		while (literal < end) {
+			size_t count = std::min<size_t>(end - literal, 128);
+			out.push_back(static_cast<uint8_t>(count - 1));
+			out.insert(out.end(), planes.begin() + literal, planes.begin() + literal + count);
+			literal += count;
+		}
+	};
+	while (i < size) {
+		size_t run = 1;
+		while (i + run < size && run < 130 && planes[i + run] == planes[i]) {
+			run++;
+		}
+		if (run >= 3) {
+			flush_literal(i);
+			out.push_back(static_cast<uint8_t>(run + 125));
+			out.push_back(planes[i]);
+			i += run;
+			literal = i;
+		}
+		else {
+			i += run;
+		}
+		if (out.size() >= size) {
+			return false;
+		}
+	}
+	flush_literal(size);
+	return out.size() < size;
+}
+
+void put_big(uint32_t v, char* out) {
+	out[0] = static_cast<char>(v >> 24);
+	out[1] = static_cast<char>(v >> 16);
+	out[2] = static_cast<char>(v >> 8);
+	out[3] = static_cast<char>(v);
+}
+
+void put_big(float v, char* out) {
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	put_big(bits, out);
+}
+
+class Text_writer : public Output_writer {
+	Stream_writer stream;
+	Grid grid;
+	int components;
+	size_t written;
+	char line[512];
+
+	void print(int length) {
+		stream.write(line, std::min<size_t>(length, sizeof(line) - 1));
+	}
+
+public:
+	explicit Text_writer(Output_settings const& settings) :
+		stream(settings.buffer),
+		components(0),
+		written(0) { }
+
+	bool open(std::string const& path, std::string* error) {
+		return stream.open(path, error);
+	}
+
+	void write_zones(std::vector<Box> const& zones) override {
+		print(snprintf(line, sizeof(line), "%zu\n", zones.size()));
+		for (Box const& zone : zones) {
+			float v[6];
+			zone_values(zone, v);
+			print(snprintf(line, sizeof(line), "%g %g %g %g %g %g\n", v[0], v[1], v[2], v[3], v[4], v[5]));
+		}
+	}
+
+	void begin_field(std::string const&, Grid const& grid, int components) override {
+		this->grid = grid;
+		this->components = components;
+		written = 0;
+		print(snprintf(line, sizeof(line), "%zu\n", grid.size()));
+	}
+
+	void write_samples(float const* values, size_t count) override {
+		for (size_t s = 0; s < count; s++, written++) {
+			int i = static_cast<int>(written % grid.count[0]);
+			int j = static_cast<int>(written / grid.count[0] % grid.count[1]);
+			int k = static_cast<int>(written / grid.count[0] / grid.count[1]);
+			int length = snprintf(line, sizeof(line), "%d %d %d", i, j, k);
+			for (int c = 0; c < components && length < 400; c++) {
+				length += snprintf(line + length, sizeof(line) - length, " %g", values[s * components + c]);
+			}
+			line[length++] = '\n';
+			print(length);
+		}
+	}
+
+	bool close(std::string* error) override {
+		return stream.close(error);
+	}
+};
+
+class Binary_writer : public Output_writer {
+	enum {
+		ZONES = 1,
+		FIELD = 2
+	};
+
+	Stream_writer stream;
+	Output_settings settings;
+	int components;
+	uint64_t remaining;
+	std::vector<float> samples;  // interleaved, as given
+	std::vector<float> planes;
+	std::vector<uint8_t> shuffled;
+	std::vector<uint8_t> packed;
+	std::string problem;
+
+	void put(uint32_t v) {
+		stream.write(&v, sizeof(v));
+	}
+
+	void section(uint32_t kind, int components, uint64_t count) {
+		if (remaining != 0 && problem.empty()) {
+			problem = "a section started before the last one had all its samples";
+		}
+		put(kind);
+		put(static_cast<uint32_t>(components));
+		stream.write(&count, sizeof(count));
+		this->components = components;
+		remaining = count;
+		samples.clear();
+	}
+
+	void flush_chunk() {
+		size_t n = samples.size() / components;
+		if (n == 0) {
+			return;
+		}
+		planes.resize(samples.size());
+		for (size_t i = 0; i < n; i++) {
+			for (int c = 0; c < components; c++) {
+				planes[c * n + i] = samples[i * components + c];
+			}
+		}
+		samples.clear();
+		uint32_t codec = 0;
+		void const* payload = planes.data();
+		size_t bytes = planes.size() * sizeof(float);
+		if (settings.compress && pack(planes.data(), planes.size(), shuffled, packed)) {
+			codec = 1;
+			payload = packed.data();
+			bytes = packed.size();
+		}
+		put(codec);
+		put(static_cast<uint32_t>(n));
+		put(static_cast<uint32_t>(bytes));
+		stream.write(payload, bytes);
+	}
+
+	void add(float const* values, size_t count) {
+		size_t chunk = std::max(settings.chunk_samples, 1);
+		if (count > remaining) {
+			if (problem.empty()) {
+				problem = "more samples than the section holds";
+			}
+			count = static_cast<size_t>(remaining);
+		}
+		remaining -= count;
+		while (count > 0) {
+			size_t n = std::min(count, chunk - samples.size() / components);
+			samples.insert(samples.end(), values, values + n * components);
+			values += n * components;
+			count -= n;
+			if (samples.size() / components == chunk) {
+				flush_chunk();
+			}
+		}
+		if (remaining == 0) {
+			flush_chunk();
+		}
+	}
+
+public:
+	explicit Binary_writer(Output_settings const& settings) :
+		stream(settings.buffer),
+		settings(settings),
+		components(1),
+		remaining(0) { }
+
+	bool open(std::string const& path, std::string* error) {
+		if (!stream.open(path, error)) {
+			return false;
+		}
+		stream.write("QTRESULT", 8);
+		put(1);
+		put(0x01020304);
+		return true;
+	}
+
+	void write_zones(std::vector<Box> const& zones) override {
+		section(ZONES, 6, zones.size());
+		for (Box const& zone : zones) {
+			float v[6];
+			zone_values(zone, v);
+			add(v, 1);
+		}
+	}
+
+	void begin_field(std::string const& name, Grid const& grid, int components) override {
+		section(FIELD, components, grid.size());
+		stream.write(&grid.origin.x, sizeof(float));
+		stream.write(&grid.origin.y, sizeof(float));
+		stream.write(&grid.origin.z, sizeof(float));
+		stream.write(&grid.step.x, sizeof(float));
+		stream.write(&grid.step.y, sizeof(float));
+		stream.write(&grid.step.z, sizeof(float));
+		for (int j = 0; j < 3; j++) {
+			put(static_cast<uint32_t>(grid.count[j]));
+		}
+		put(static_cast<uint32_t>(name.size()));
+		stream.write(name.data(), name.size());
+	}
+
+	void write_samples(float const* values, size_t count) override {
+		add(values, count);
+	}
+
+	bool close(std::string* error) override {
+		if (remaining != 0 && problem.empty()) {
+			problem = "the last section misses samples";
+		}
+		if (!stream.close(error)) {
+			return false;
+		}
+		return problem.empty() || fail(error, problem);
+	}
+};
+
+class Vtk_writer : public Output_writer {
+	Stream_writer fields;
+	std::string path;
+	std::string stem;
+	Output_settings settings;
+	Grid grid;
+	int components;
+	std::vector<char> buffer;
+	std::string problem;
+
+	void text(std::string const& s) {
+		fields.write(s.data(), s.size());
+	}
+
+public:
+	explicit Vtk_writer(Output_settings const& settings) :
+		fields(settings.buffer),
+		settings(settings),
+		components(0) { }
+
+	// each file is opened when it is written, close reports what failed
+	bool open(std::string const& path, std::string*) {
+		this->path = path;
+		stem = ends_with(path, ".vtk") ? path.substr(0, path.size() - 4) : path;
+		return true;
+	}
+
+	void write_zones(std::vector<Box> const& zones) override {
+		Stream_writer out(settings.buffer);
+		std::string error;
+		if (!out.open(stem + "_zones.vtk", &error)) {
+			if (problem.empty()) {
+				problem = error;
+			}
+			return;
+		}
+		std::string header = "# vtk DataFile Version 3.0\nquadtree zones\nBINARY\nDATASET UNSTRUCTURED_GRID\nPOINTS "
+			+ std::to_string(zones.size() * 8) + " float\n";
+		out.write(header.data(), header.size());
+		char bytes[36];
+		for (Box const& zone : zones) {
+			// VOXEL corner order: x fastest, then y, then z
+			for (int corner = 0; corner < 8; corner++) {
+				put_big((corner & 1 ? zone.second : zone.first).x, bytes);
+				put_big((corner & 2 ? zone.second : zone.first).y, bytes + 4);
+				put_big((corner & 4 ? zone.second : zone.first).z, bytes + 8);
+				out.write(bytes, 12);
+			}
+		}
+		header = "\nCELLS " + std::to_string(zones.size()) + ' ' + std::to_string(zones.size() * 9) + '\n';
+		out.write(header.data(), header.size());
+		for (size_t i = 0; i < zones.size(); i++) {
+			put_big(8u, bytes);
+			for (uint32_t corner = 0; corner < 8; corner++) {
+				put_big(static_cast<uint32_t>(i * 8 + corner), bytes + 4 + 4 * corner);
+			}
+			out.write(bytes, 36);
+		}
+		header = "\nCELL_TYPES " + std::to_string(zones.size()) + '\n';
+		out.write(header.data(), header.size());
+		put_big(11u, bytes);
+		for (size_t i = 0; i < zones.size(); i++) {
+			out.write(bytes, 4);
+		}
+		out.write("\n", 1);
+		if (!out.close(&error) && problem.empty()) {
+			problem = error;
+		}
+	}
+
+	void begin_field(std::string const& name, Grid const& grid, int components) override {
+		this->components = components;
+		if (!fields.is_open()) {
+			std::string error;
+			if (!fields.open(path, &error)) {
+				if (problem.empty()) {
+					problem = error;
+				}
+				return;
+			}
+			this->grid = grid;
+			char header[512];
+			snprintf(header, sizeof(header), "# vtk DataFile Version 3.0\nquadtree fields\nBINARY\n"
+				"DATASET STRUCTURED_POINTS\nDIMENSIONS %d %d %d\nORIGIN %.9g %.9g %.9g\nSPACING %.9g %.9g %.9g\n"
+				"POINT_DATA %zu\n", grid.count[0], grid.count[1], grid.count[2], grid.origin.x, grid.origin.y,
+				grid.origin.z, grid.step.x, grid.step.y, grid.step.z, grid.size());
+			text(header);
+		}
+		else {
+			bool same = this->grid.size() == grid.size();
+			for (int j = 0; j < 3; j++) {
+				same = same && this->grid.count[j] == grid.count[j] && this->grid.origin[j] == grid.origin[j]
+					&& this->grid.step[j] == grid.step[j];
+			}
+			if (!same && problem.empty()) {
+				problem = "a VTK file holds one grid, field " + name + " is on another";
+			}
+			text("\n");
+		}
+		if (components == 3) {
+			text("VECTORS " + name + " float\n");
+		}
+		else {
+			text("SCALARS " + name + " float " + std::to_string(components) + "\nLOOKUP_TABLE default\n");
+		}
+	}
+
+	void write_samples(float const* values, size_t count) override {
+		if (!fields.is_open()) {
+			return;
+		}
+		size_t n = count * components;
+		buffer.resize(n * 4);
+		for (size_t i = 0; i < n; i++) {
+			put_big(values[i], &buffer[i * 4]);
+		}
+		fields.write(buffer.data(), buffer.size());
+	}
+
+	bool close(std::string* error) override {
+		if (fields.is_open()) {
+			text("\n");
+			if (!fields.close(error)) {
+				return false;
+			}
+		}
+		return problem.empty() || fail(error, problem);
+	}
+};
+}
+
+Stream_writer::Stream_writer(size_t chunk) :
+	chunk(std::max<size_t>(chunk, 1)),
+	has_pending(false),
+	closing(false),
+	failed(false) { }
+
+Stream_writer::~Stream_writer() {
+	close();
+}
+
+bool Stream_writer::open(std::string const& path, std::string* error) {
+	close();
+	out.open(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) {
+		return fail(error, "can't create " + path);
+	}
+	this->path = path;
+	filling.clear();
+	filling.reserve(chunk);
+	pending.clear();
+	pending.reserve(chunk);
+	has_pending = false;
+	closing = false;
+	failed = false;
+	thread = std::thread(&Stream_writer::run, this);
+	return true;
+}
+
+bool Stream_writer::is_open() const {
+	return thread.joinable();
+}
+
+void Stream_writer::run() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		changed.wait(guard, [&] { return has_pending || closing; });
+		if (!has_pending) {
+			return;
+		}
+		guard.unlock();
+		out.write(pending.data(), pending.size());
+		guard.lock();
+		failed = failed || !out;
+		pending.clear();
+		has_pending = false;
+		changed.notify_all();
+	}
+}
+
+void Stream_writer::hand_over() {
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [&] { return !has_pending; });
+	std::swap(filling, pending);
+	has_pending = true;
+	changed.notify_all();
+}
+
+void Stream_writer::write(void const* data, size_t size) {
+	char const* bytes = static_cast<char const*>(data);
+	while (size > 0) {
+		size_t n = std::min(chunk - filling.size(), size);
+		filling.insert(filling.end(), bytes, bytes + n);
+		bytes += n;
+		size -= n;
+		if (filling.size() == chunk) {
+			hand_over();
+		}
+	}
+}
+
+bool Stream_writer::close(std::string* error) {
+	if (!thread.joinable()) {
+		return true;
+	}
+	if (!filling.empty()) {
+		hand_over();
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closing = true;
+	}
+	changed.notify_all();
+	thread.join();
+	out.close();
+	if (failed || !out) {
+		return fail(error, "can't write " + path);
+	}
+	return true;
+}
+
+Output_settings::Output_settings() :
+	format(BINARY_OUTPUT),
+	buffer(1 << 22),
+	chunk_samples(1 << 16),
+	compress(true) { }
+
+OutputFormat output_format(std::string const& path) {
+	if (ends_with(path, ".txt")) {
+		return TEXT_OUTPUT;
+	}
+	if (ends_with(path, ".vtk")) {
+		return VTK_OUTPUT;
+	}
+	return BINARY_OUTPUT;
+}
+
+Output_writer::~Output_writer() { }
+
+std::unique_ptr<Output_writer> open_output(std::string const& path, Output_settings const& settings,
+	std::string* error) {
+	switch (settings.format) {
+	case TEXT_OUTPUT: {
+		std::unique_ptr<Text_writer> writer(new Text_writer(settings));
+		if (!writer->open(path, error)) {
+			return nullptr;
+		}
+		return writer;
+	}
+	case VTK_OUTPUT: {
+		std::unique_ptr<Vtk_writer> writer(new Vtk_writer(settings));
+		if (!writer->open(path, error)) {
+			return nullptr;
+		}
+		return writer;
+	}
+	default: {
+		std::unique_ptr<Binary_writer> writer(new Binary_writer(settings));
+		if (!writer->open(path, error)) {
+			return nullptr;
+		}
+		return writer;
+	}
+	}
+}
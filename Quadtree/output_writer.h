@@ -0,0 +1,110 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "geometry.h"
+#include "grid_sampler.h"
+
+// Appends bytes to a file from a background thread. write() fills one
+// chunk while the thread stores the other, so the caller only waits when
+// it fills a chunk before the previous one has reached the disk.
+class Stream_writer {
+	std::ofstream out;
+	std::string path;
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<char> filling;
+	std::vector<char> pending;   // owned by the thread while has_pending
+	size_t chunk;
+	bool has_pending;
+	bool closing;
+	bool failed;
+
+	void run();
+	void hand_over();
+
+public:
+	explicit Stream_writer(size_t chunk = 1 << 22);
+	~Stream_writer();
+
+	Stream_writer(Stream_writer const&) = delete;
+	Stream_writer& operator=(Stream_writer const&) = delete;
+
+	bool open(std::string const& path, std::string* error = nullptr);
+	bool is_open() const;
+	void write(void const* data, size_t size);
+	// waits until everything written is in the file and closes it
+	bool close(std::string* error = nullptr);
+};
+
+enum OutputFormat {
+	TEXT_OUTPUT,
+	BINARY_OUTPUT,
+	VTK_OUTPUT
+};
+
+struct Output_settings {
+	Output_settings();
+
+	OutputFormat format;
+	size_t buffer;       // bytes of each chunk handed to the background thread
+	int chunk_samples;   // samples per chunk of the binary format
+	bool compress;       // binary chunks are byte shuffled and run-length coded
+};
+
+// .txt is text, .vtk is VTK and anything else is binary
+OutputFormat output_format(std::string const& path);
+
+// Results of a run: the zones of a tree and fields sampled on grids.
+// Writes only copy into a buffer, formatting aside the file is written
+// by a background thread. Errors show up in close().
+//
+// TEXT_OUTPUT is the old output.txt: the zone count, a line of centre and
+// half-extents per zone, then for a field the sample count and a line
+// "i j k value..." per sample.
+//
+// BINARY_OUTPUT keeps the floats as they are. All numbers are in the byte
+// order of the writer, byte_order reads 0x01020304 in the same one:
+//   char magic[8] "QTRESULT", uint32 version 1, uint32 byte_order
+//   sections, each
+//     uint32 kind (1 zones, 2 field), uint32 components, uint64 samples
+//     fields only: float origin[3], float step[3], int32 count[3],
+//       uint32 name length, the name without a terminator
+//     chunks until all samples are there, each
+//       uint32 codec, uint32 samples, uint32 payload bytes, payload
+// A zone is the 6 floats of a text line. The payload of a chunk with n
+// samples holds n floats of component 0, then n of component 1 and so on.
+// Codec 0 stores those floats raw. Codec 1 first regroups them into 4
+// planes of n * components bytes, byte 0 of every float first, and then
+// codes runs: a control byte c < 128 is followed by c + 1 literal bytes,
+// c >= 128 by one byte repeated c - 125 times.
+//
+// VTK_OUTPUT writes legacy binary VTK files for ParaView: the zones go to
+// <name>_zones.vtk as VOXEL cells of an UNSTRUCTURED_GRID, the fields to
+// <name>.vtk as point data of a STRUCTURED_POINTS set. A VTK file holds
+// one grid, so every field has to be sampled on the same grid.
+class Output_writer {
+public:
+	virtual ~Output_writer();
+
+	virtual void write_zones(std::vector<Box> const& zones) = 0;
+	// starts a field of components floats per sample, the samples follow
+	// through write_samples
+	virtual void begin_field(std::string const& name, Grid const& grid, int components) = 0;
+	// the next count samples of the field, x fastest, then y, then z, with
+	// the components of a sample next to each other
+	virtual void write_samples(float const* values, size_t count) = 0;
+	virtual bool close(std::string* error = nullptr) = 0;
+};
+
+// nullptr and error set if the file can't be created. The VTK files are
+// only created once something is written to them.
+std::unique_ptr<Output_writer> open_output(std::string const& path, Output_settings const& settings = Output_settings(),
+	std::string* error = nullptr);
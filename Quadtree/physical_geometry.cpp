@@ -1,4 +1,8 @@
 #include "physical_geometry.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <utility>
 
 PObject::PObject(const std::vector<Point>& points, std::vector<std::vector<int> > connect, float charge) :
 	Object(points, connect),
@@ -8,6 +12,10 @@ PObject::PObject(const std::vector<Triangle>& trianguals, float charge) :
 	Object(trianguals),
 	charge(charge) { }
 
+PObject::PObject(Indexed_mesh mesh, float charge) :
+	Object(std::move(mesh)),
+	charge(charge) { }
+
 PObject::PObject(Box trianguals, float charge) :
 	Object(trianguals),
 	charge(charge) { }
@@ -16,6 +24,77 @@ PObject::PObject(Object const& object, float charge) :
 	Object(object),
 	charge(charge) { }
 
+PObject::PObject(Object&& object, float charge) :
+	Object(std::move(object)),
+	charge(charge) { }
+
 float PObject::get_charge() const {
 	return charge;
 }
+
+void PObject::set_charge(float charge_) {
+	charge = charge_;
+}
+
+float PObject::charge_in(Box const& limit, bool full, Point& centre) const {
+	centre = (limit.first + limit.second) / 2;
+	if (charge == 0 || get_volume() == 0) {
+		return 0;
+	}
+	Point size = limit.second - limit.first;
+	if (full) {
+		return charge * size.x * size.y * size.z / get_volume();
+	}
+	return charge * volume_in(limit, &centre) / get_volume();
+}
+
+Box PObject::part_in(Box const& limit, bool full, Point centre, float share) const {
+	Box part = limit;
+	if (full || charge == 0) {
+		return part;
+	}
+	float half = cbrtf(share / charge * get_volume()) / 2;
+	for (int j = 0; j < 3; j++) {
+		part.first[j] = std::max(limit.first[j], centre[j] - half);
+		part.second[j] = std::min(limit.second[j], centre[j] + half);
+	}
+	return part;
+}
+
+bool PObject::has_surface_charges() const {
+	return !surface_charges.empty();
+}
+
+std::vector<float> const& PObject::get_surface_charges() const {
+	return surface_charges;
+}
+
+void PObject::set_surface_charges(std::vector<float> charges) {
+	assert(charges.empty() || charges.size() == size());
+	surface_charges = std::move(charges);
+}
+
+void PObject::surface_triangles_in(Box const& limit, std::vector<int>& result) const {
+	std::vector<int> found;
+	candidates(limit, found);
+	for (int i : found) {
+		Triangle t = triangle(i);
+		Point c = (t.points[0] + t.points[1] + t.points[2]) / 3;
+		bool inside = true;
+		for (int j = 0; j < 3; j++) {
+			inside = inside && limit.first[j] <= c[j] && c[j] < limit.second[j];
+		}
+		if (inside) {
+			result.push_back(i);
+		}
+	}
+}
+
+void PObject::surface_charges_in(Box const& limit, std::vector<std::pair<Point, float> >& result) const {
+	std::vector<int> found;
+	surface_triangles_in(limit, found);
+	for (int i : found) {
+		Triangle t = triangle(i);
+		result.push_back(std::make_pair((t.points[0] + t.points[1] + t.points[2]) / 3, surface_charges[i]));
+	}
+}
@@ -1,13 +1,41 @@
 #pragma once
+#include <utility>
+#include <vector>
 #include "geometry.h"
 
 class PObject : public Object {
 	float charge;
+	// charge of every triangle once a surface solve ran, empty before
+	std::vector<float> surface_charges;
 public:
 	PObject(const std::vector<Point>& points, std::vector<std::vector<int> > connect, float charge);
 	PObject(const std::vector<Triangle>& trianguals, float charge);
+	PObject(Indexed_mesh mesh, float charge);
 	PObject(Box trianguals, float charge);
 	PObject(Object const& object, float charge);
+	PObject(Object&& object, float charge);
 
+	// the total, spread evenly through the volume unless there are surface charges
 	float get_charge() const;
+	void set_charge(float charge);
+	// The share of charge in limit, the whole box is inside when full.
+	// centre gets the centroid of the share.
+	float charge_in(Box const& limit, bool full, Point& centre) const;
+	// where a share found by charge_in is spread: limit when full,
+	// otherwise a cube of its volume about centre, clipped to limit
+	Box part_in(Box const& limit, bool full, Point centre, float share) const;
+
+	// With surface charges set they stand for the object in the tree
+	// payloads and charge is only the total they were solved for. Solve
+	// again after a charge or a transform changes, an empty vector goes
+	// back to the charge of the whole object.
+	bool has_surface_charges() const;
+	std::vector<float> const& get_surface_charges() const;
+	void set_surface_charges(std::vector<float> charges);
+	// the triangles whose centroid lies in [limit.first, limit.second), so
+	// the boxes of a partition share the surface charges out without
+	// counting one twice
+	void surface_triangles_in(Box const& limit, std::vector<int>& result) const;
+	// centroid and charge of the same triangles
+	void surface_charges_in(Box const& limit, std::vector<std::pair<Point, float> >& result) const;
 };
@@ -1,43 +1,287 @@
 #include "physical_quadtree.h"
 #include "physical_geometry.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <utility>
 
 Phy_node::Phy_node() :
 	charge_point(),
-	sum_charge(0) { }
+	sum_charge() { }
 
-Point Phy_node::get_point() const {
-	return charge_point;
+void Phy_node::add(Point charge_point_, float sum_charge_) {
+	int part = sum_charge_ < 0 ? 1 : 0;
+	charge_point[part] = charge_point[part] + charge_point_;
+	sum_charge[part] += sum_charge_;
+}
+
+Point Phy_node::get_centre() const {
+	float weight = get_weight();
+	if (weight == 0) {
+		return charge_point[0];
+	}
+	return (charge_point[0] - charge_point[1]) / weight;
 }
 
 float Phy_node::get_charge() const {
-	return sum_charge;
+	return sum_charge[0] + sum_charge[1];
 }
 
-Phy_node::Phy_node(Point charge_point, float sum_charge) :
-	charge_point(charge_point),
-	sum_charge(sum_charge) { }
+float Phy_node::get_weight() const {
+	return sum_charge[0] - sum_charge[1];
+}
 
-Phy_node Phy_node::get_value(std::vector<PObject const*> const& objects, Box limit) {
-	float sum = 0;
+Point Phy_node::get_centre(int part) const {
+	if (sum_charge[part] == 0) {
+		return charge_point[part];
+	}
+	return charge_point[part] / sum_charge[part];
+}
+
+float Phy_node::get_charge(int part) const {
+	return sum_charge[part];
+}
+
+Phy_node Phy_node::collect(std::vector<PObject const*> const& objects, Box limit, bool full) {
+	std::vector<std::pair<Point, float> > surface;
+	// a FULL box is inside one of the objects, the others may only cross
+	// it and are measured like in a surface box
+	bool whole = full && objects.size() == 1;
 	for (auto object : objects) {
-		sum += object->get_charge();
+		if (object->has_surface_charges()) {
+			object->surface_charges_in(limit, surface);
+		}
+		else {
+			Point centre;
+			float charge = object->charge_in(limit, whole, centre);
+			surface.push_back(std::make_pair(centre, charge));
+		}
+	}
+	Phy_node result;
+	for (auto const& charge : surface) {
+		result.add(charge.first * charge.second, charge.second);
 	}
-	return Phy_node(
-		(limit.first + limit.second) / 2 * sum,
-		sum
-	);
+	return result;
+}
+
+Phy_node Phy_node::get_value(std::vector<PObject const*> const& objects, Box limit) {
+	return collect(objects, limit, true);
+}
+
+Phy_node Phy_node::get_surface_value(std::vector<PObject const*> const& objects, Box limit) {
+	return collect(objects, limit, false);
 }
 
 Phy_node Phy_node::merge(Phy_node const& a, Phy_node const& b) {
-	return Phy_node(
-		a.get_point() + b.get_point(),
-		a.get_charge() + b.get_charge()
-	);
+	Phy_node result;
+	for (int part = 0; part < 2; part++) {
+		result.charge_point[part] = a.charge_point[part] + b.charge_point[part];
+		result.sum_charge[part] = a.sum_charge[part] + b.sum_charge[part];
+	}
+	return result;
+}
+
+Physical_quadtree::Physical_quadtree(std::vector<PObject> const& objects, const Box& limit, float theta,
+	Build_settings const& settings, node_pool* arena)
+	: Quadtree<Phy_node>(objects, limit, settings, arena),
+	theta(theta) { }
+
+Physical_quadtree::Physical_quadtree(Scene& scene, const Box& limit, float theta,
+	Build_settings const& settings, node_pool* arena)
+	: Quadtree<Phy_node>(scene, limit, settings, arena),
+	theta(theta) { }
+
+void Physical_quadtree::set_theta(float theta_) {
+	theta = theta_;
+}
+
+float Physical_quadtree::get_theta() const {
+	return theta;
+}
+
+void Physical_quadtree::updated() {
+	near_lists.clear();
+}
+
+Near_sources const& Physical_quadtree::near_of(node const* leaf) const {
+	{
+		std::shared_lock<std::shared_mutex> lock(near_lock);
+		auto found = near_lists.find(leaf);
+		if (found != near_lists.end()) {
+			return found->second;
+		}
+	}
+	// found outside the lock, two threads may both do it and the first
+	// one's list is kept; the map keeps its elements in place on insertion
+	Near_sources sources(get_scene(), leaf->limit, leaf->type == FULL_NODE, leaf->data.get_charge(),
+		leaf->data.get_centre());
+	std::lock_guard<std::shared_mutex> lock(near_lock);
+	return near_lists.emplace(leaf, std::move(sources)).first->second;
+}
+
+bool Physical_quadtree::is_far(Point p, node const* cur) const {
+	Point d = p - cur->data.get_centre();
+	Point size = cur->limit.second - cur->limit.first;
+	float width = std::max(size.x, std::max(size.y, size.z));
+	return !cur->limit.contains(p) && width * width < theta * theta * dot_product(d, d);
+}
+
+bool Physical_quadtree::is_far(Box const& box, node const* cur) const {
+	Box const& limit = cur->limit;
+	Point c = cur->data.get_centre();
+	bool apart = false;
+	for (int j = 0; j < 3; j++) {
+		apart = apart || limit.second[j] < box.first[j] || box.second[j] < limit.first[j];
+	}
+	if (!apart) {
+		// the node may contain a point of box
+		return false;
+	}
+	float dist = 0;
+	for (int j = 0; j < 3; j++) {
+		float gap = std::max(box.first[j] - c[j], std::max(c[j] - box.second[j], 0.0f));
+		dist += gap * gap;
+	}
+	Point size = limit.second - limit.first;
+	float width = std::max(size.x, std::max(size.y, size.z));
+	return width * width < theta * theta * dist;
+}
+
+void Physical_quadtree::add_far(Point p, Phy_node const& data, Point& field, float& potential) const {
+	for (int part = 0; part < 2; part++) {
+		if (data.get_charge(part) != 0) {
+			add_charge_field(p, data.get_centre(part), data.get_charge(part), field, potential);
+		}
+	}
+}
+
+void Physical_quadtree::add_near(Point p, node const* leaf, Point& field, float& potential) const {
+	near_of(leaf).add_field(p, field, potential);
+}
+
+void Physical_quadtree::add_field(Point p, node const* cur, Point& field, float& potential) const {
+	if (cur == nullptr || cur->data.get_weight() == 0) {
+		return;
+	}
+	if (is_far(p, cur)) {
+		add_far(p, cur->data, field, potential);
+		return;
+	}
+	split(const_cast<node*>(cur));
+	if (is_leaf(cur)) {
+		add_near(p, cur, field, potential);
+		return;
+	}
+	for (node const* child : cur->children) {
+		add_field(p, child, field, potential);
+	}
+}
+
+void Physical_quadtree::add_field(std::vector<Point> const& points, std::vector<int> const& active, node const* cur,
+	std::vector<Point>& field, std::vector<float>* potential) const {
+	if (cur == nullptr || cur->data.get_weight() == 0) {
+		return;
+	}
+	std::vector<int> open;
+	for (int i : active) {
+		if (is_far(points[i], cur)) {
+			float unused = 0;
+			add_far(points[i], cur->data, field[i], potential != nullptr ? (*potential)[i] : unused);
+		}
+		else {
+			open.push_back(i);
+		}
+	}
+	if (open.empty()) {
+		return;
+	}
+	split(const_cast<node*>(cur));
+	if (is_leaf(cur)) {
+		for (int i : open) {
+			float unused = 0;
+			add_near(points[i], cur, field[i], potential != nullptr ? (*potential)[i] : unused);
+		}
+		return;
+	}
+	for (node const* child : cur->children) {
+		add_field(points, open, child, field, potential);
+	}
+}
+
+Point Physical_quadtree::field_at(Point p) const {
+	Point field;
+	float potential = 0;
+	add_field(p, root, field, potential);
+	return field;
 }
 
-Physical_quadtree::Physical_quadtree(std::vector<PObject> const& objects, const Box& limit)
-	: Quadtree<Phy_node>(objects, limit) { }
+float Physical_quadtree::potential_at(Point p) const {
+	Point field;
+	float potential = 0;
+	add_field(p, root, field, potential);
+	return potential;
+}
 
 float Physical_quadtree::get_charge(Point point) const {
 	return get_data(get(point, root, 0)).get_charge();
 }
+
+void Physical_quadtree::field_at(std::vector<Point> const& points, std::vector<Point>& field,
+	std::vector<float>* potential) const {
+	field.assign(points.size(), Point());
+	if (potential != nullptr) {
+		potential->assign(points.size(), 0);
+	}
+	std::vector<int> active(points.size());
+	for (size_t i = 0; i < points.size(); i++) {
+		active[i] = static_cast<int>(i);
+	}
+	add_field(points, active, root, field, potential);
+}
+
+void Physical_quadtree::add_interactions(Box const& box, node const* cur, Interaction_list& list) const {
+	if (cur == nullptr || cur->data.get_weight() == 0) {
+		return;
+	}
+	if (is_far(box, cur)) {
+		for (int part = 0; part < 2; part++) {
+			if (cur->data.get_charge(part) != 0) {
+				list.centres.push_back(cur->data.get_centre(part));
+				list.charges.push_back(cur->data.get_charge(part));
+			}
+		}
+		return;
+	}
+	split(const_cast<node*>(cur));
+	if (is_leaf(cur)) {
+		list.near.push_back(cur);
+		return;
+	}
+	for (node const* child : cur->children) {
+		add_interactions(box, child, list);
+	}
+}
+
+void Physical_quadtree::interactions(Box const& box, Interaction_list& list) const {
+	list.centres.clear();
+	list.charges.clear();
+	list.near.clear();
+	add_interactions(box, root, list);
+}
+
+void Physical_quadtree::field_at(Point p, Interaction_list const& list, Point& field, float& potential) const {
+	field = Point();
+	potential = 0;
+	for (size_t i = 0; i < list.centres.size(); i++) {
+		add_charge_field(p, list.centres[i], list.charges[i], field, potential);
+	}
+	for (node const* leaf : list.near) {
+		// near the box but maybe not near p
+		if (is_far(p, leaf)) {
+			add_far(p, leaf->data, field, potential);
+		}
+		else {
+			add_near(p, leaf, field, potential);
+		}
+	}
+}
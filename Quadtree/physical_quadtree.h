@@ -1,25 +1,102 @@
 #pragma once
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 #include "geometry.h"
+#include "near_field.h"
 #include "quadtree.h"
 #include "physical_geometry.h"
 
 class Phy_node {
-	Point charge_point;
-	float sum_charge;
+	// part 0 holds the positive charges and part 1 the negative ones, each
+	// as the sum of charge * position and the sum of charge. Far away a
+	// node is one charge at the centroid of each part, so a neutral node
+	// holding a dipole still has its field.
+	Point charge_point[2];
+	float sum_charge[2];
+
+	void add(Point charge_point, float sum_charge);
+	// all of the box is inside the objects when full, a part of it
+	// otherwise, see PObject::charge_in
+	static Phy_node collect(std::vector<PObject const*> const& objects, Box limit, bool full);
 
 public:
 	Phy_node();
-	Point get_point() const;
+	// the centre of |charge|, where the opening test measures from
+	Point get_centre() const;
+	// net charge
 	float get_charge() const;
-	Phy_node(Point charge_point, float sum_charge);
+	// sum of |charge|, 0 for a node without charges
+	float get_weight() const;
+	Point get_centre(int part) const;
+	float get_charge(int part) const;
+
 	static Phy_node get_value(std::vector<PObject const*> const& objects, Box limit);
+	static Phy_node get_surface_value(std::vector<PObject const*> const& objects, Box limit);
 	static Phy_node merge(Phy_node const& a, Phy_node const& b);
 };
 
 class Physical_quadtree : public Quadtree<Phy_node> {
+	// opening angle of the Barnes-Hut walk: a node is replaced by its
+	// aggregate when size / distance < theta
+	float theta;
+
+	// A query close to a leaf sums its charges directly, see Near_sources.
+	// The charges of a leaf are found when a query first comes close to it
+	// and found again after an update.
+	mutable std::shared_mutex near_lock;
+	mutable std::unordered_map<node const*, Near_sources> near_lists;
+
+	Near_sources const& near_of(node const* leaf) const;
+	void updated() override;
+
+	void add_far(Point p, Phy_node const& data, Point& field, float& potential) const;
+	void add_near(Point p, node const* leaf, Point& field, float& potential) const;
+	// the walks split a node of a lazy tree only when they open it
+	void add_field(Point p, node const* cur, Point& field, float& potential) const;
+	void add_field(std::vector<Point> const& points, std::vector<int> const& active, node const* cur,
+		std::vector<Point>& field, std::vector<float>* potential) const;
+	bool is_far(Point p, node const* cur) const;
+	// far for every point of box
+	bool is_far(Box const& box, node const* cur) const;
+
 public:
-	Physical_quadtree(std::vector<PObject> const& objects, Box const& limit);
+	// What any query point in one box needs, found by a single walk for
+	// the whole box: the nodes far from all of it as their charges and the
+	// leaves near some part of it. Queries in the box read the list
+	// instead of walking the tree, with the accuracy of a walk per point
+	// or better.
+	struct Interaction_list {
+		std::vector<Point> centres;
+		std::vector<float> charges;
+		std::vector<node const*> near;
+	};
+
+private:
+	void add_interactions(Box const& box, node const* cur, Interaction_list& list) const;
+
+public:
+	Physical_quadtree(std::vector<PObject> const& objects, Box const& limit, float theta = 0.5f,
+		Build_settings const& settings = Build_settings(), node_pool* arena = nullptr);
+	Physical_quadtree(Scene& scene, Box const& limit, float theta = 0.5f,
+		Build_settings const& settings = Build_settings(), node_pool* arena = nullptr);
 
 	float get_charge(Point point) const;
+
+	void set_theta(float theta);
+	float get_theta() const;
+
+	// Coulomb field and potential in units with k = 1
+	Point field_at(Point p) const;
+	float potential_at(Point p) const;
+
+	// evaluates a whole batch with one shared tree walk: a node is visited
+	// once for all points that still have to open it
+	void field_at(std::vector<Point> const& points, std::vector<Point>& field,
+		std::vector<float>* potential = nullptr) const;
+
+	void interactions(Box const& box, Interaction_list& list) const;
+	// p must lie in the box of list
+	void field_at(Point p, Interaction_list const& list, Point& field, float& potential) const;
 };
@@ -1,7 +1,18 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include "geometry.h"
+#include "node_pool.h"
 #include "physical_geometry.h"
+#include "scene.h"
+#include "simd.h"
+#include "split_policy.h"
+#include "stats.h"
+#include "thread_pool.h"
 
 enum NodeType {
 	EMPTY_NODE = 1,
@@ -13,98 +24,246 @@ enum NodeType {
 //class Data_example<T> {
 //public:
 //	T get_value(std::vector<PObject const*>, Box);
+//	// a box crossed by the surfaces of objects, a finest one or one a
+//	// lazy tree has not split yet, it holds their surface charges and
+//	// the part of their volume charges inside it
+//	T get_surface_value(std::vector<PObject const*>, Box);
 //	T merge(T const& a, T const& b);
 //};
 
+struct Build_settings {
+	Build_settings();
+
+	int threads;          // 1 builds serially, 0 uses every hardware thread
+	int parallel_height;  // subtrees rooted above this height become tasks
+	int max_height;       // nodes below this height are not split further
+	bool lazy;            // split nodes on the first query that reaches them
+};
+
+inline Build_settings::Build_settings() :
+	threads(1),
+	parallel_height(10),
+	max_height(16),
+	lazy(false) { }
+
 template <class T>
+class Flat_quadtree;
+
+template <class T, class Split = Binary_split>
 class Quadtree {
-	const int MAX_H = 16;
+	friend class Flat_quadtree<T>;
+
+protected:
+	// A node of a lazy tree goes PENDING -> SPLIT when its children are
+	// made and SPLIT -> COMPLETE when its whole subtree is made. The other
+	// two states mark the thread doing a step, the rest wait for it. Eager
+	// nodes are COMPLETE. A PENDING node gets T::get_surface_value of its
+	// box when it is made, the aggregate of the subtree it stands for, and
+	// neither step changes it, so data can be read in any state.
+	enum Split_state : uint8_t {
+		PENDING,
+		SPLITTING,
+		SPLIT,
+		COMPLETING,
+		COMPLETE
+	};
+
+	struct pending_split;
 
 	struct node {
-		node(node* left, node* right, Box limit, int height, NodeType full_empty);
-		node(node* left, node* right, Box limit, int height);
+		node(node* const* children, Box limit, int height, int plan);
 		node(Box limit, int height, NodeType full_empty, T data);
+		node(Box limit, int height, pending_split* pending, T data);
 
-		node* left;
-		node* right;
+		node* children[Split::ARITY];
 		Box limit;
 		int height;
-		NodeType type;
+		// set before the node is published as SPLIT; complete may later narrow
+		// NO_EMPTY to EMPTY or FULL, the children stay so a reader that saw
+		// NO_EMPTY finds the same type below
+		std::atomic<NodeType> type;
+		std::atomic<uint8_t> state;
+		uint8_t plan;            // how Split cut the box
+		pending_split* pending;  // what split needs, only while PENDING
 		T data;
 	};
 
-	std::vector<PObject> objects;
-	std::vector<Box> zones;
-
-	NodeType test_for_in_out(Box limit);
-	void add_zone(Box limit);
+public:
+	typedef Node_pool<node> node_pool;
 
-	node* dfs(Box limit, int height);
-	void clear_dfs(node* cur);
+private:
+	// an object whose surface may still touch the current box
+	struct Candidate {
+		Object_handle object;
+		std::vector<int> triangles;
+	};
+	// only objects with candidate triangles are listed
+	typedef std::vector<Candidate> Candidates;
 
-	std::vector<PObject const*> get_all_intersection(Box limit);
-	static NodeType get_type(node* v);
+	std::unique_ptr<Scene> own_scene;
+	Scene* scene;
+	std::vector<Box> zones;
+	Box limit;
+	Build_settings settings;
+	Thread_pool* pool;
+	std::unique_ptr<node_pool> own_nodes;
+	node_pool* nodes;
+
+	void build();
+	void gather(Box limit, Candidates& candidates) const;
+
+	NodeType test_for_in_out(Box limit, Candidates const& candidates, Candidates& overlap,
+		std::vector<PObject const*>& intersection) const;
+	static void add_zone(std::vector<Box>& zones, Box limit);
+
+	// a lazy dfs stops at the first NO_EMPTY node and leaves it PENDING
+	node* dfs(Box limit, int height, Candidates const& candidates, std::vector<Box>& zones, bool lazy) const;
+	int plan(Box limit, int height, Candidates const& overlap) const;
+	void clear_dfs(node* cur) const;
+	static NodeType get_type(node const* v);
+	static NodeType merge_type(node const* const* children);
+	static T merge_data(node const* const* children);
+	static bool is_complete(node const* v);
+	void add_zones(node const* cur, std::vector<Box>& result) const;
+
+	// incremental repair after update_object, region holds the old and
+	// the new bounds of the changed object
+	typedef std::pair<Box, Box> Region;
+	static bool touches(Box const& a, Region const& region);
+	void recharge(node* cur, Region const& region);
+	node* rebuild(node* cur, Box limit, int height, Candidates const& candidates, Region const& region,
+		std::vector<Box> const& old_zones, size_t& next_zone);
+
+	// the batched queries take points a packet at a time, a range of a
+	// packet that reaches a node with fewer than SCALAR_POINTS points goes
+	// on point by point, a partition of so few costs more than it saves
+	enum {
+		LOCATE_PACKET = 4096,
+		SCALAR_POINTS = 32
+	};
+	void locate(node const* cur, int height, Point_packet const& from, Point_packet const& to,
+		Point_packet const& spill, size_t first, size_t last, node const** result) const;
+	// result[i - first] is the leaf of points[i]
+	void locate(Point_batch const& points, size_t first, size_t last, node const** result) const;
 
 protected:
+	struct pending_split {
+		Candidates candidates;
+	};
+
+	// Both make a lazy tree catch up before a node is read, they are
+	// no-ops on eager trees and safe to call from several threads. A
+	// reader calls split before it looks at the type or the children of
+	// a node, and complete before it needs the whole subtree.
+	void split(node* cur, bool whole = false) const;
+	void complete(node* cur) const;
+
 	node* get(Point t, node* cur, int height) const;
-	static T get_data(node* v);
+	static T get_data(node const* v);
+	static bool is_leaf(node const* v);
 	node* root;
 
+	// called after update_object has repaired the tree, a subclass drops
+	// here what it keeps about the old nodes
+	virtual void updated();
+
 public:
-	Quadtree(std::vector<PObject> const& objects_, Box limit);
-	~Quadtree();
+	// nodes come from arena when given, it must outlive the tree and serve
+	// one tree at a time: clear() drops everything in it
+	Quadtree(std::vector<PObject> const& objects_, Box limit, Build_settings const& settings = Build_settings(),
+		node_pool* arena = nullptr);
+	// the scene is referenced, not copied, and must outlive the tree
+	Quadtree(Scene& scene, Box limit, Build_settings const& settings = Build_settings(),
+		node_pool* arena = nullptr);
+	virtual ~Quadtree();
 	void clear();
 
+	// Change one object of the scene and repair the tree in place, with
+	// the same result as a new build. A new charge only recomputes the
+	// payloads of the nodes touching the object. A transform rebuilds the
+	// nodes touching its old or new bounds and reuses every other subtree.
+	// Other trees on the same scene are not updated.
+	void update_object(Object_handle id, float charge);
+	void update_object(Object_handle id, Transform const& transform);
+
+	// In a lazy tree a query may stop at a smaller FULL node than in
+	// an eager build, so get_data can return a part of the aggregate.
+	// The type of every point is the same.
 	bool is_empty_point(Point p) const;
-	float get_data(Point p) const;
+	bool is_full_point(Point p) const;
+	T get_data(Point p) const;
+
+	// Batched versions of the point queries. Packets of points walk down
+	// the tree together and are split with vector compares against the
+	// split planes, results are the same as point by point.
+	void is_empty_points(Point_batch const& points, uint8_t* result) const;
+	void get_data(Point_batch const& points, T* result) const;
 
+	Box get_limit() const;
+	Scene const& get_scene() const;
+
+	// a lazy tree is made completely first
 	std::vector<Box> get_zones() const;
 };
 
-inline std::pair<Box, Box> divide_box(int h, Box limit) {
-	Point s = (limit.first + limit.second) / 2;
-	Box a = limit;
-	Box b = limit;
-	int cur_d = h % 3;
-	a.first[cur_d] = s[cur_d];
-	b.second[cur_d] = s[cur_d];
-	return std::make_pair(a, b);
+template <class T, class Split>
+Quadtree<T, Split>::node::node(node* const* children_, Box limit, int height, int plan) :
+	limit(limit),
+	height(height),
+	type(merge_type(children_)),
+	state(COMPLETE),
+	plan(static_cast<uint8_t>(plan)),
+	pending(nullptr),
+	data(merge_data(children_)) {
+	for (int i = 0; i < Split::ARITY; i++) {
+		children[i] = children_[i];
+		if (!is_complete(children[i])) {
+			state = SPLIT;
+		}
+	}
 }
 
-template <class T>
-Quadtree<T>::node::node(node* left, node* right, Box limit, int height, NodeType full_empty) :
-	left(left),
-	right(right),
+template <class T, class Split>
+Quadtree<T, Split>::node::node(Box limit, int height, NodeType full_empty, T data) :
+	children(),
 	limit(limit),
 	height(height),
 	type(full_empty),
-	data() { }
-
-template <class T>
-Quadtree<T>::node::node(node* left, node* right, Box limit, int height) :
-	left(left),
-	right(right),
-	limit(limit),
-	height(height) {
-	type = static_cast<NodeType>(get_type(left) | get_type(right));
-	data = T::merge(get_data(left), get_data(right));
-}
+	state(COMPLETE),
+	plan(0),
+	pending(nullptr),
+	data(data) { }
 
-template <class T>
-Quadtree<T>::node::node(Box limit, int height, NodeType full_empty, T data) :
-	left(nullptr),
-	right(nullptr),
+template <class T, class Split>
+Quadtree<T, Split>::node::node(Box limit, int height, pending_split* pending, T data) :
+	children(),
 	limit(limit),
 	height(height),
-	type(full_empty),
+	type(NO_EMPTY_NODE),
+	state(PENDING),
+	plan(0),
+	pending(pending),
 	data(data) { }
 
 
-template <class T>
-NodeType Quadtree<T>::test_for_in_out(Box limit) {
+template <class T, class Split>
+NodeType Quadtree<T, Split>::test_for_in_out(Box limit, Candidates const& candidates, Candidates& overlap,
+	std::vector<PObject const*>& intersection) const {
+	QT_PHASE(CLASSIFY_PHASE);
+	// the parent box is not FULL, so an object whose surface missed it is outside
 	bool ok[4] = {};
-	for (auto obj : objects) {
-		ok[obj.cross(limit)] = true;
+	std::vector<int> triangles;
+	for (Candidate const& candidate : candidates) {
+		PObject const& object = scene->get(candidate.object);
+		CrossType type = object.cross(limit, candidate.triangles, triangles);
+		ok[type] = true;
+		if (type != EMPTY_INTERSECTION) {
+			intersection.push_back(&object);
+		}
+		if (!triangles.empty()) {
+			overlap.push_back(Candidate{ candidate.object, std::move(triangles) });
+			triangles = std::vector<int>();
+		}
 	}
 	if (ok[LIMIT_IN_OBJ]) {
 		return FULL_NODE;
@@ -115,122 +274,589 @@ NodeType Quadtree<T>::test_for_in_out(Box limit) {
 	return EMPTY_NODE;
 }
 
-template <class T>
-void Quadtree<T>::add_zone(Box limit) {
+template <class T, class Split>
+void Quadtree<T, Split>::add_zone(std::vector<Box>& zones, Box limit) {
 	zones.push_back(limit);
 }
 
-template <class T>
-typename Quadtree<T>::node* Quadtree<T>::dfs(Box limit, int height = 0) {
-	NodeType temp = test_for_in_out(limit);
+template <class T, class Split>
+typename Quadtree<T, Split>::node* Quadtree<T, Split>::dfs(Box limit, int height, Candidates const& candidates,
+	std::vector<Box>& zones, bool lazy) const {
+	QT_SUBTREE(height);
+	Candidates overlap;
+	std::vector<PObject const*> intersection;
+	NodeType temp = test_for_in_out(limit, candidates, overlap, intersection);
+	QT_NODE(height, temp);
 	if (temp == FULL_NODE) {
-		add_zone(limit);
-		return new node(
+		add_zone(zones, limit);
+		QT_PHASE(PAYLOAD_PHASE);
+		return nodes->create(
 			limit,
 			height,
 			FULL_NODE,
-			T::get_value(get_all_intersection(limit), limit)
+			T::get_value(intersection, limit)
 		);
 	}
-	if (temp == EMPTY_NODE || height > MAX_H) {
+	if (temp == EMPTY_NODE) {
 		return nullptr;
 	}
-	auto boxs = divide_box(height, limit);
-	auto left = dfs(boxs.first, height + 1);
-	auto right = dfs(boxs.second, height + 1);
-	if (get_type(left) == get_type(right)
-		&& get_type(left) == EMPTY_NODE) {
-		clear_dfs(left);
-		clear_dfs(right);
+	if (height > settings.max_height) {
+		QT_COUNT(MAX_HEIGHT_CUTS, 1);
+		// too small to split, but the box keeps the charges it holds as a
+		// leaf so the charge of the tree adds up; queries still see it empty
+		QT_PHASE(PAYLOAD_PHASE);
+		return nodes->create(
+			limit,
+			height,
+			NO_EMPTY_NODE,
+			T::get_surface_value(intersection, limit)
+		);
+	}
+	if (lazy) {
+		QT_PHASE(PAYLOAD_PHASE);
+		return nodes->create(
+			limit,
+			height,
+			new pending_split{ std::move(overlap) },
+			T::get_surface_value(intersection, limit)
+		);
+	}
+	int how = plan(limit, height, overlap);
+	Box parts[Split::ARITY];
+	Split::divide(limit, how, parts);
+	node* children[Split::ARITY];
+	if (pool != nullptr && height < settings.parallel_height) {
+		// every child but the first gets its own zone list so the zones
+		// keep the serial order
+		std::vector<Box> child_zones[Split::ARITY];
+		Task_group group(*pool);
+		for (int i = 1; i < Split::ARITY; i++) {
+			group.run([&, i] {
+				children[i] = dfs(parts[i], height + Split::STEP, overlap, child_zones[i], false);
+			});
+		}
+		children[0] = dfs(parts[0], height + Split::STEP, overlap, zones, false);
+		group.wait();
+		for (int i = 1; i < Split::ARITY; i++) {
+			zones.insert(zones.end(), child_zones[i].begin(), child_zones[i].end());
+		}
+	}
+	else {
+		for (int i = 0; i < Split::ARITY; i++) {
+			children[i] = dfs(parts[i], height + Split::STEP, overlap, zones, false);
+		}
+	}
+	if (merge_type(children) == EMPTY_NODE) {
+		for (node* child : children) {
+			clear_dfs(child);
+		}
 		return nullptr;
 	}
-	return new node(
-		left,
-		right,
+	return nodes->create(
+		children,
 		limit,
-		height
+		height,
+		how
 	);
 }
 
-template <class T>
-typename Quadtree<T>::node* Quadtree<T>::get(Point t, node* cur, int height = 0) const {
-	if (cur == nullptr) {
+template <class T, class Split>
+int Quadtree<T, Split>::plan(Box limit, int height, Candidates const& overlap) const {
+	if (!Split::USES_SURFACE) {
+		return Split::plan(limit, height, limit);
+	}
+	// bounds of the triangles crossing the box, clipped to it
+	Box surface(limit.second, limit.first);
+	for (Candidate const& candidate : overlap) {
+		Indexed_mesh const& mesh = scene->get(candidate.object).get_mesh();
+		for (int i : candidate.triangles) {
+			for (int k = 0; k < 3; k++) {
+				Point p = mesh.corner(i, k);
+				for (int j = 0; j < 3; j++) {
+					surface.first[j] = std::min(surface.first[j], p[j]);
+					surface.second[j] = std::max(surface.second[j], p[j]);
+				}
+			}
+		}
+	}
+	for (int j = 0; j < 3; j++) {
+		surface.first[j] = std::max(surface.first[j], limit.first[j]);
+		surface.second[j] = std::min(surface.second[j], limit.second[j]);
+	}
+	return Split::plan(limit, height, surface);
+}
+
+// whole builds the subtree eagerly, as complete wants it
+template <class T, class Split>
+void Quadtree<T, Split>::split(node* cur, bool whole) const {
+	if (cur == nullptr || cur->state.load(std::memory_order_acquire) >= SPLIT) {
+		return;
+	}
+	uint8_t expected = PENDING;
+	if (!cur->state.compare_exchange_strong(expected, SPLITTING, std::memory_order_acquire)) {
+		while (cur->state.load(std::memory_order_acquire) == SPLITTING) {
+			std::this_thread::yield();
+		}
+		return;
+	}
+	std::unique_ptr<pending_split> pending(cur->pending);
+	cur->pending = nullptr;
+	// the zones are collected by get_zones instead
+	std::vector<Box> unused;
+	cur->plan = static_cast<uint8_t>(plan(cur->limit, cur->height, pending->candidates));
+	Box parts[Split::ARITY];
+	Split::divide(cur->limit, cur->plan, parts);
+	bool done = true;
+	for (int i = 0; i < Split::ARITY; i++) {
+		cur->children[i] = dfs(parts[i], cur->height + Split::STEP, pending->candidates, unused, !whole);
+		done &= is_complete(cur->children[i]);
+	}
+	cur->type = merge_type(cur->children);
+	cur->state.store(done ? COMPLETE : SPLIT, std::memory_order_release);
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::complete(node* cur) const {
+	if (cur == nullptr || cur->state.load(std::memory_order_acquire) == COMPLETE) {
+		return;
+	}
+	split(cur, true);
+	uint8_t expected = SPLIT;
+	if (!cur->state.compare_exchange_strong(expected, COMPLETING, std::memory_order_acquire)) {
+		while (cur->state.load(std::memory_order_acquire) != COMPLETE) {
+			std::this_thread::yield();
+		}
+		return;
+	}
+	for (node* child : cur->children) {
+		complete(child);
+	}
+	// readers may walk through the node meanwhile, so the children are
+	// kept even when they turn out EMPTY and the type is stored last
+	cur->type = merge_type(cur->children);
+	cur->state.store(COMPLETE, std::memory_order_release);
+}
+
+template <class T, class Split>
+typename Quadtree<T, Split>::node* Quadtree<T, Split>::get(Point t, node* cur, int height) const {
+	if (cur == nullptr || (height == 0 && !cur->limit.contains(t))) {
 		return nullptr;
 	}
+	split(cur);
 	if (cur->type != NO_EMPTY_NODE) {
 		return cur;
 	}
-	auto boxs = divide_box(height, cur->limit);
-	if (boxs.first.contains(t)) {
-		return get(t, cur->left, height + 1);
+	return get(t, cur->children[Split::child(cur->limit, cur->plan, t)], height + Split::STEP);
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::locate(node const* cur, int height, Point_packet const& from, Point_packet const& to,
+	Point_packet const& spill, size_t first, size_t last, node const** result) const {
+	split(const_cast<node*>(cur));
+	if (cur == nullptr || cur->type != NO_EMPTY_NODE) {
+		for (size_t i = first; i < last; i++) {
+			result[from.id[i]] = cur;
+		}
+		return;
+	}
+	if (last - first < SCALAR_POINTS) {
+		for (size_t i = first; i < last; i++) {
+			result[from.id[i]] = get(Point(from.x[i], from.y[i], from.z[i]), const_cast<node*>(cur), height);
+		}
+		return;
+	}
+	Box const& limit = cur->limit;
+	size_t bounds[Split::ARITY + 1];
+	bounds[0] = first;
+	if (Split::ARITY == 2) {
+		// a two-way policy halves the box along the plan axis
+		int d = cur->plan;
+		bounds[1] = first + partition_points(from, to, spill, first, last, d, (limit.first[d] + limit.second[d]) / 2);
+	}
+	else {
+		// counting sort by child, one scalar pass to count and one to move
+		size_t count[Split::ARITY] = {};
+		for (size_t i = first; i < last; i++) {
+			count[Split::child(limit, cur->plan, Point(from.x[i], from.y[i], from.z[i]))]++;
+		}
+		size_t next[Split::ARITY];
+		for (int c = 0; c < Split::ARITY; c++) {
+			next[c] = bounds[c];
+			bounds[c + 1] = bounds[c] + count[c];
+		}
+		for (size_t i = first; i < last; i++) {
+			size_t j = next[Split::child(limit, cur->plan, Point(from.x[i], from.y[i], from.z[i]))]++;
+			to.x[j] = from.x[i];
+			to.y[j] = from.y[i];
+			to.z[j] = from.z[i];
+			to.id[j] = from.id[i];
+		}
+	}
+	bounds[Split::ARITY] = last;
+	// the children read from to and write back into from
+	for (int c = 0; c < Split::ARITY; c++) {
+		if (bounds[c] < bounds[c + 1]) {
+			locate(cur->children[c], height + Split::STEP, to, from, spill, bounds[c], bounds[c + 1], result);
+		}
 	}
-	return get(t, cur->right, height + 1);
 }
 
-template <class T>
-void Quadtree<T>::clear_dfs(node* cur) {
-	if (cur != nullptr) {
-		clear_dfs(cur->left);
-		clear_dfs(cur->right);
-		delete cur;
+template <class T, class Split>
+void Quadtree<T, Split>::locate(Point_batch const& points, size_t first, size_t last, node const** result) const {
+	const size_t stride = LOCATE_PACKET + 16;
+	// kept by the thread between calls, a query of a few points allocates nothing
+	thread_local std::vector<float> buffer(9 * stride);
+	thread_local std::vector<uint32_t> ids(3 * stride);
+	Point_packet packet[3];
+	for (int i = 0; i < 3; i++) {
+		float* base = buffer.data() + 3 * i * stride;
+		packet[i].x = base;
+		packet[i].y = base + stride;
+		packet[i].z = base + 2 * stride;
+		packet[i].id = ids.data() + i * stride;
+	}
+	size_t n = 0;
+	for (size_t i = first; i < last; i++) {
+		if (root == nullptr || !limit.contains(points[i])) {
+			result[i - first] = nullptr;
+			continue;
+		}
+		packet[0].x[n] = points.x[i];
+		packet[0].y[n] = points.y[i];
+		packet[0].z[n] = points.z[i];
+		packet[0].id[n] = static_cast<uint32_t>(i - first);
+		n++;
 	}
+	locate(root, 0, packet[0], packet[1], packet[2], 0, n, result);
 }
 
-template <class T>
-std::vector<PObject const*> Quadtree<T>::get_all_intersection(Box limit) {
-	std::vector<PObject const*> result;
-	for (auto obj : objects) {
-		auto t = obj.cross(limit);
-		if (t != EMPTY_INTERSECTION) {
-			result.push_back(&obj);
+template <class T, class Split>
+void Quadtree<T, Split>::is_empty_points(Point_batch const& points, uint8_t* result) const {
+	node const* found[LOCATE_PACKET];
+	for (size_t first = 0; first < points.size(); first += LOCATE_PACKET) {
+		size_t last = std::min(points.size(), first + static_cast<size_t>(LOCATE_PACKET));
+		locate(points, first, last, found);
+		for (size_t i = first; i < last; i++) {
+			result[i] = get_type(found[i - first]) == EMPTY_NODE;
 		}
 	}
-	return result;
 }
 
-template <class T>
-T Quadtree<T>::get_data(node* v) {
+template <class T, class Split>
+void Quadtree<T, Split>::get_data(Point_batch const& points, T* result) const {
+	node const* found[LOCATE_PACKET];
+	for (size_t first = 0; first < points.size(); first += LOCATE_PACKET) {
+		size_t last = std::min(points.size(), first + static_cast<size_t>(LOCATE_PACKET));
+		locate(points, first, last, found);
+		for (size_t i = first; i < last; i++) {
+			result[i] = get_data(found[i - first]);
+		}
+	}
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::clear_dfs(node* cur) const {
+	if (cur != nullptr) {
+		for (node* child : cur->children) {
+			clear_dfs(child);
+		}
+		delete cur->pending;
+		nodes->destroy(cur);
+	}
+}
+
+template <class T, class Split>
+T Quadtree<T, Split>::get_data(node const* v) {
 	if (v == nullptr) {
 		return T();
 	}
 	return v->data;
 }
 
-template <class T>
-NodeType Quadtree<T>::get_type(node* v) {
+template <class T, class Split>
+NodeType Quadtree<T, Split>::get_type(node const* v) {
 	if (v == nullptr) {
 		return EMPTY_NODE;
 	}
 	return v->type;
 }
 
-template <class T>
-Quadtree<T>::Quadtree(std::vector<PObject> const& objects_, Box limit) : objects(objects_) {
-	root = dfs(limit, 0);
+template <class T, class Split>
+NodeType Quadtree<T, Split>::merge_type(node const* const* children) {
+	int result = 0;
+	for (int i = 0; i < Split::ARITY; i++) {
+		result |= get_type(children[i]);
+	}
+	return static_cast<NodeType>(result);
 }
 
-template <class T>
-Quadtree<T>::~Quadtree() {
+template <class T, class Split>
+T Quadtree<T, Split>::merge_data(node const* const* children) {
+	T result = get_data(children[0]);
+	for (int i = 1; i < Split::ARITY; i++) {
+		result = T::merge(result, get_data(children[i]));
+	}
+	return result;
+}
+
+template <class T, class Split>
+bool Quadtree<T, Split>::is_leaf(node const* v) {
+	for (node const* child : v->children) {
+		if (child != nullptr) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <class T, class Split>
+bool Quadtree<T, Split>::is_complete(node const* v) {
+	return v == nullptr || v->state.load(std::memory_order_acquire) == COMPLETE;
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::add_zones(node const* cur, std::vector<Box>& result) const {
+	if (cur == nullptr) {
+		return;
+	}
+	if (is_leaf(cur)) {
+		if (cur->type == FULL_NODE) {
+			add_zone(result, cur->limit);
+		}
+		return;
+	}
+	for (node const* child : cur->children) {
+		add_zones(child, result);
+	}
+}
+
+template <class T, class Split>
+Quadtree<T, Split>::Quadtree(std::vector<PObject> const& objects_, Box limit, Build_settings const& settings,
+	node_pool* arena) :
+	own_scene(new Scene(objects_)),
+	scene(own_scene.get()),
+	limit(limit),
+	settings(settings),
+	pool(nullptr),
+	own_nodes(arena == nullptr ? new node_pool() : nullptr),
+	nodes(arena == nullptr ? own_nodes.get() : arena) {
+	build();
+}
+
+template <class T, class Split>
+Quadtree<T, Split>::Quadtree(Scene& scene, Box limit, Build_settings const& settings, node_pool* arena) :
+	scene(&scene),
+	limit(limit),
+	settings(settings),
+	pool(nullptr),
+	own_nodes(arena == nullptr ? new node_pool() : nullptr),
+	nodes(arena == nullptr ? own_nodes.get() : arena) {
+	build();
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::gather(Box limit, Candidates& candidates) const {
+	QT_PHASE(GATHER_PHASE);
+	// only the objects near the box take part, each with the triangles
+	// its own hierarchy finds there
+	std::vector<Object_handle> near;
+	scene->query(limit, near);
+	for (Object_handle id : near) {
+		Candidate candidate{ id, std::vector<int>() };
+		scene->get(id).candidates(limit, candidate.triangles);
+		std::sort(candidate.triangles.begin(), candidate.triangles.end());
+		candidates.push_back(std::move(candidate));
+	}
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::build() {
+	QT_PHASE(BUILD_PHASE);
+	nodes->reset();
+	Candidates candidates;
+	gather(limit, candidates);
+	if (settings.threads == 1 || settings.lazy) {
+		root = dfs(limit, 0, candidates, zones, settings.lazy);
+		return;
+	}
+	Thread_pool threads(settings.threads);
+	pool = &threads;
+	root = dfs(limit, 0, candidates, zones, false);
+	pool = nullptr;
+}
+
+template <class T, class Split>
+bool Quadtree<T, Split>::touches(Box const& a, Region const& region) {
+	Box const* boxes[2] = { &region.first, &region.second };
+	for (Box const* b : boxes) {
+		bool apart = false;
+		for (int i = 0; i < 3; i++) {
+			apart |= a.second[i] < b->first[i] || b->second[i] < a.first[i];
+		}
+		if (!apart) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::recharge(node* cur, Region const& region) {
+	if (cur == nullptr || !touches(cur->limit, region)) {
+		return;
+	}
+	if (is_leaf(cur)) {
+		if (cur->type == EMPTY_NODE) {
+			// a lazy node split into nothing
+			return;
+		}
+		// a FULL or surface leaf, or a lazy node not split yet, its objects
+		// are found again as the build found them
+		Candidates candidates;
+		Candidates overlap;
+		std::vector<PObject const*> intersection;
+		gather(cur->limit, candidates);
+		test_for_in_out(cur->limit, candidates, overlap, intersection);
+		QT_PHASE(PAYLOAD_PHASE);
+		cur->data = cur->type == FULL_NODE ? T::get_value(intersection, cur->limit) :
+			T::get_surface_value(intersection, cur->limit);
+		return;
+	}
+	for (node* child : cur->children) {
+		recharge(child, region);
+	}
+	cur->data = merge_data(cur->children);
+}
+
+template <class T, class Split>
+typename Quadtree<T, Split>::node* Quadtree<T, Split>::rebuild(node* cur, Box limit, int height, Candidates const& candidates,
+	Region const& region, std::vector<Box> const& old_zones, size_t& next_zone) {
+	// zones come in depth-first order, so the old ones of this box are
+	// the next ones in the old list
+	auto skip_zones = [&](bool keep) {
+		for (; next_zone < old_zones.size(); next_zone++) {
+			Box const& zone = old_zones[next_zone];
+			if (!limit.contains(zone.first) || !limit.contains(zone.second)) {
+				break;
+			}
+			if (keep) {
+				add_zone(zones, zone);
+			}
+		}
+	};
+	if (!touches(limit, region)) {
+		// the changed object was never near this box
+		skip_zones(true);
+		return cur;
+	}
+	Candidates overlap;
+	std::vector<PObject const*> intersection;
+	NodeType type = test_for_in_out(limit, candidates, overlap, intersection);
+	QT_NODE(height, type);
+	// an adaptive split may cut the box differently now, then the old
+	// children are no use
+	int how = type == NO_EMPTY_NODE ? plan(limit, height, overlap) : 0;
+	bool inner = cur != nullptr && !is_leaf(cur) && cur->plan == how;
+	if (type != NO_EMPTY_NODE || height > settings.max_height || !inner) {
+		skip_zones(false);
+		clear_dfs(cur);
+		return dfs(limit, height, candidates, zones, settings.lazy);
+	}
+	Box parts[Split::ARITY];
+	Split::divide(limit, how, parts);
+	node* children[Split::ARITY];
+	for (int i = 0; i < Split::ARITY; i++) {
+		children[i] = rebuild(cur->children[i], parts[i], height + Split::STEP, overlap, region, old_zones,
+			next_zone);
+	}
+	nodes->destroy(cur);
+	if (merge_type(children) == EMPTY_NODE) {
+		for (node* child : children) {
+			clear_dfs(child);
+		}
+		return nullptr;
+	}
+	return nodes->create(
+		children,
+		limit,
+		height,
+		how
+	);
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::update_object(Object_handle id, float charge) {
+	QT_PHASE(BUILD_PHASE);
+	scene->set_charge(id, charge);
+	Box bounds = scene->get(id).get_bounds();
+	recharge(root, Region(bounds, bounds));
+	updated();
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::update_object(Object_handle id, Transform const& transform) {
+	QT_PHASE(BUILD_PHASE);
+	Box old_bounds = scene->get(id).get_bounds();
+	scene->transform(id, transform);
+	Region region(old_bounds, scene->get(id).get_bounds());
+	Candidates candidates;
+	gather(limit, candidates);
+	std::vector<Box> old_zones;
+	old_zones.swap(zones);
+	size_t next_zone = 0;
+	root = rebuild(root, limit, 0, candidates, region, old_zones, next_zone);
+	updated();
+}
+
+template <class T, class Split>
+void Quadtree<T, Split>::updated() { }
+
+template <class T, class Split>
+Quadtree<T, Split>::~Quadtree() {
 	clear();
 }
 
-template <class T>
-void Quadtree<T>::clear() {
-	clear_dfs(root);
+template <class T, class Split>
+void Quadtree<T, Split>::clear() {
+	if (!std::is_trivially_destructible<node>::value || settings.lazy) {
+		clear_dfs(root);
+	}
+	nodes->reset();
 	root = nullptr;
 }
 
-template <class T>
-bool Quadtree<T>::is_empty_point(Point p) const {
-	return get_type(get(p, root, 0)) == EMPTY_INTERSECTION;
+template <class T, class Split>
+bool Quadtree<T, Split>::is_empty_point(Point p) const {
+	return get_type(get(p, root, 0)) == EMPTY_NODE;
 }
 
-template <class T>
-float Quadtree<T>::get_data(Point p) const {
+template <class T, class Split>
+bool Quadtree<T, Split>::is_full_point(Point p) const {
+	return get_type(get(p, root, 0)) == FULL_NODE;
+}
+
+template <class T, class Split>
+T Quadtree<T, Split>::get_data(Point p) const {
 	return get_data(get(p, root, 0));
 }
 
-template <class T>
-std::vector<Box> Quadtree<T>::get_zones() const {
-	return zones;
+template <class T, class Split>
+std::vector<Box> Quadtree<T, Split>::get_zones() const {
+	if (!settings.lazy) {
+		return zones;
+	}
+	complete(root);
+	std::vector<Box> result;
+	add_zones(root, result);
+	return result;
+}
+
+template <class T, class Split>
+Box Quadtree<T, Split>::get_limit() const {
+	return limit;
+}
+
+template <class T, class Split>
+Scene const& Quadtree<T, Split>::get_scene() const {
+	return *scene;
 }
@@ -0,0 +1,184 @@
+#pragma once
+// Vector bodies of the separating axis tests, included by the simd_*.cpp
+// files after they switched on their instruction set. V wraps one
+// register type:
+//   reg, mask, WIDTH, load, set1, add, sub, mul, min, max, abs,
+//   le, lt, both, either, none, bits
+// Every expression follows the scalar code in geometry.cpp operation by
+// operation, so the results are exactly the same.
+#include "simd.h"
+
+namespace sat {
+	template <class V>
+	struct vec3 {
+		typename V::reg x, y, z;
+	};
+
+	template <class V>
+	inline vec3<V> sub(vec3<V> const& a, vec3<V> const& b) {
+		return { V::sub(a.x, b.x), V::sub(a.y, b.y), V::sub(a.z, b.z) };
+	}
+
+	template <class V>
+	inline vec3<V> cross(vec3<V> const& a, vec3<V> const& b) {
+		return {
+			V::sub(V::mul(a.y, b.z), V::mul(a.z, b.y)),
+			V::sub(V::mul(a.z, b.x), V::mul(a.x, b.z)),
+			V::sub(V::mul(a.x, b.y), V::mul(a.y, b.x))
+		};
+	}
+
+	template <class V>
+	inline typename V::reg dot(vec3<V> const& a, vec3<V> const& b) {
+		return V::add(V::add(V::mul(a.x, b.x), V::mul(a.y, b.y)), V::mul(a.z, b.z));
+	}
+
+	template <class V>
+	inline vec3<V> broadcast(float const* p) {
+		return { V::set1(p[0]), V::set1(p[1]), V::set1(p[2]) };
+	}
+
+	template <class V>
+	inline vec3<V> load(Triangle_packet const& packet, int vertex, int lane) {
+		return {
+			V::load(packet.v[3 * vertex] + lane),
+			V::load(packet.v[3 * vertex + 1] + lane),
+			V::load(packet.v[3 * vertex + 2] + lane)
+		};
+	}
+
+	// get_interval + overlap_on_axis
+	template <class V>
+	inline typename V::mask overlap(vec3<V> const* a, vec3<V> const* b, vec3<V> const& axis) {
+		typename V::reg a_min = dot(axis, a[0]);
+		typename V::reg a_max = a_min;
+		typename V::reg b_min = dot(axis, b[0]);
+		typename V::reg b_max = b_min;
+		for (int i = 1; i < 3; i++) {
+			typename V::reg value = dot(axis, a[i]);
+			a_min = V::min(a_min, value);
+			a_max = V::max(a_max, value);
+			value = dot(axis, b[i]);
+			b_min = V::min(b_min, value);
+			b_max = V::max(b_max, value);
+		}
+		return V::both(V::le(b_min, a_max), V::le(a_min, b_max));
+	}
+
+	template <class V>
+	inline void store(typename V::mask m, int lane, Triangle_packet const& packet, uint8_t* result) {
+		int bits = V::bits(m);
+		for (int i = 0; i < V::WIDTH && lane + i < packet.size; i++) {
+			result[lane + i] = (bits >> i) & 1;
+		}
+	}
+
+	// cross_triangle_triangle(t, packet[i])
+	template <class V>
+	void triangles(float const* t, Triangle_packet const& packet, uint8_t* result) {
+		vec3<V> t1[3] = { broadcast<V>(t), broadcast<V>(t + 3), broadcast<V>(t + 6) };
+		vec3<V> t1_f0 = sub(t1[1], t1[0]);
+		vec3<V> t1_f1 = sub(t1[2], t1[1]);
+		vec3<V> t1_f2 = sub(t1[0], t1[2]);
+		vec3<V> t1_normal = cross(t1_f0, t1_f1);
+
+		for (int lane = 0; lane < packet.size; lane += V::WIDTH) {
+			vec3<V> t2[3] = { load<V>(packet, 0, lane), load<V>(packet, 1, lane), load<V>(packet, 2, lane) };
+			vec3<V> t2_f[3] = { sub(t2[1], t2[0]), sub(t2[2], t2[1]), sub(t2[0], t2[2]) };
+
+			typename V::mask ok = overlap(t1, t2, t1_normal);
+			ok = V::both(ok, overlap(t1, t2, cross(t2_f[0], t2_f[1])));
+			for (int i = 0; i < 3 && !V::none(ok); i++) {
+				ok = V::both(ok, overlap(t1, t2, cross(t2_f[i], t1_f0)));
+				ok = V::both(ok, overlap(t1, t2, cross(t2_f[i], t1_f1)));
+				ok = V::both(ok, overlap(t1, t2, cross(t2_f[i], t1_f2)));
+			}
+			store<V>(ok, lane, packet, result);
+		}
+	}
+
+	template <class V>
+	inline typename V::reg min3(typename V::reg a, typename V::reg b, typename V::reg c) {
+		return V::min(a, V::min(b, c));
+	}
+
+	template <class V>
+	inline typename V::reg max3(typename V::reg a, typename V::reg b, typename V::reg c) {
+		return V::max(a, V::max(b, c));
+	}
+
+	// cross_triangle_box(packet[i], box), touch_scale is 1 - TOUCH_EPS
+	template <class V>
+	void box(float const* limit, float touch_scale, Triangle_packet const& packet, uint8_t* result) {
+		float centre[3];
+		float half[3];
+		for (int i = 0; i < 3; i++) {
+			centre[i] = (limit[i] + limit[3 + i]) / 2;
+			half[i] = (limit[3 + i] - limit[i]) / 2;
+		}
+		vec3<V> c = broadcast<V>(centre);
+		typename V::reg h[3] = { V::set1(half[0]), V::set1(half[1]), V::set1(half[2]) };
+		typename V::reg scale = V::set1(touch_scale);
+
+		for (int lane = 0; lane < packet.size; lane += V::WIDTH) {
+			vec3<V> v[3] = {
+				sub(load<V>(packet, 0, lane), c),
+				sub(load<V>(packet, 1, lane), c),
+				sub(load<V>(packet, 2, lane), c)
+			};
+
+			// Box normals
+			typename V::mask ok = V::all();
+			typename V::reg const* coord[3][3] = {
+				{ &v[0].x, &v[1].x, &v[2].x },
+				{ &v[0].y, &v[1].y, &v[2].y },
+				{ &v[0].z, &v[1].z, &v[2].z }
+			};
+			for (int i = 0; i < 3; i++) {
+				typename V::reg low = min3<V>(*coord[i][0], *coord[i][1], *coord[i][2]);
+				typename V::reg high = max3<V>(*coord[i][0], *coord[i][1], *coord[i][2]);
+				typename V::reg radius = V::mul(h[i], scale);
+				typename V::reg neg_radius = V::sub(V::set1(0), radius);
+				ok = V::both(ok, V::both(V::lt(low, radius), V::lt(neg_radius, high)));
+			}
+
+			// Cross products of box normals and triangle edges. With a unit
+			// normal two terms of the scalar dot and radius are +-0 and the
+			// others are exact copies, so only the nonzero ones are kept.
+			vec3<V> e[3] = { sub(v[1], v[0]), sub(v[2], v[1]), sub(v[0], v[2]) };
+			for (int j = 0; j < 3 && !V::none(ok); j++) {
+				typename V::reg zero = V::set1(0);
+				for (int i = 0; i < 3; i++) {
+					// axis = e_i x edge, a.k.a. (0, -z, y), (z, 0, -x), (-y, x, 0)
+					int p = (i + 1) % 3;
+					int q = (i + 2) % 3;
+					typename V::reg const* comp[3] = { &e[j].x, &e[j].y, &e[j].z };
+					typename V::reg axis_p = V::sub(zero, *comp[q]);
+					typename V::reg axis_q = *comp[p];
+					typename V::reg vp[3] = { *coord[p][0], *coord[p][1], *coord[p][2] };
+					typename V::reg vq[3] = { *coord[q][0], *coord[q][1], *coord[q][2] };
+					typename V::reg proj[3];
+					for (int k = 0; k < 3; k++) {
+						typename V::reg a = V::mul(axis_p, vp[k]);
+						typename V::reg b = V::mul(axis_q, vq[k]);
+						// the scalar sum runs in x, y, z order
+						proj[k] = p < q ? V::add(a, b) : V::add(b, a);
+					}
+					typename V::reg ra = V::mul(h[p], V::abs(axis_p));
+					typename V::reg rb = V::mul(h[q], V::abs(axis_q));
+					typename V::reg radius = V::mul(p < q ? V::add(ra, rb) : V::add(rb, ra), scale);
+					typename V::reg neg_radius = V::sub(zero, radius);
+					typename V::reg low = min3<V>(proj[0], proj[1], proj[2]);
+					typename V::reg high = max3<V>(proj[0], proj[1], proj[2]);
+					ok = V::both(ok, V::both(V::le(low, radius), V::le(neg_radius, high)));
+				}
+			}
+
+			// Triangle normal
+			vec3<V> n = cross(e[0], e[1]);
+			typename V::reg radius = V::add(V::add(V::mul(h[0], V::abs(n.x)), V::mul(h[1], V::abs(n.y))), V::mul(h[2], V::abs(n.z)));
+			ok = V::both(ok, V::lt(V::abs(dot(n, v[0])), V::mul(radius, scale)));
+			store<V>(ok, lane, packet, result);
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#include "scene.h"
+#include <algorithm>
+#include <utility>
+
+Scene::Scene() { }
+
+Scene::Scene(std::vector<PObject> objects) :
+	objects(std::move(objects)) {
+	build();
+}
+
+void Scene::build() {
+	std::vector<Box> bounds;
+	bounds.reserve(objects.size());
+	for (PObject const& object : objects) {
+		bounds.push_back(object.get_bounds());
+	}
+	bvh = Box_bvh(bounds);
+}
+
+Object_handle Scene::add(PObject object) {
+	objects.push_back(std::move(object));
+	build();
+	return static_cast<Object_handle>(objects.size() - 1);
+}
+
+void Scene::set_charge(Object_handle id, float charge) {
+	objects[id].set_charge(charge);
+}
+
+void Scene::transform(Object_handle id, Transform const& t) {
+	objects[id].transform(t);
+	// a rebuild over the object boxes is cheap next to the tree repair
+	build();
+}
+
+void Scene::set_surface_charges(Object_handle id, std::vector<float> charges) {
+	objects[id].set_surface_charges(std::move(charges));
+}
+
+size_t Scene::size() const {
+	return objects.size();
+}
+
+PObject const& Scene::get(Object_handle id) const {
+	return objects[id];
+}
+
+void Scene::query(Box limit, std::vector<Object_handle>& result) const {
+	std::vector<int> found;
+	bvh.query(limit, found);
+	// handle order, so aggregates add up the same way as a plain loop
+	std::sort(found.begin(), found.end());
+	result.assign(found.begin(), found.end());
+}
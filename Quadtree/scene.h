@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+#include "geometry.h"
+#include "physical_geometry.h"
+
+typedef uint32_t Object_handle;
+
+// The charged objects of one setup. Trees keep a reference to the scene
+// and name objects by handle, the objects themselves are never copied.
+// A hierarchy over the object bounds finds the objects near a box without
+// looking at the others.
+class Scene {
+	std::vector<PObject> objects;
+	Box_bvh bvh;
+
+	void build();
+
+public:
+	Scene();
+	explicit Scene(std::vector<PObject> objects);
+
+	// rebuilds the object hierarchy, prefer passing every object at once
+	Object_handle add(PObject object);
+
+	// Trees on the scene go stale after these, update them through
+	// Quadtree::update_object instead of calling them directly.
+	void set_charge(Object_handle id, float charge);
+	void transform(Object_handle id, Transform const& t);
+	// trees built before this miss the new charges, build them afterwards
+	void set_surface_charges(Object_handle id, std::vector<float> charges);
+
+	size_t size() const;
+	PObject const& get(Object_handle id) const;
+
+	// objects whose bounds touch limit, the rest can neither cross nor contain it
+	void query(Box limit, std::vector<Object_handle>& result) const;
+};
@@ -0,0 +1,211 @@
+#include "simd.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if SIMD_X86 && defined(__GNUC__)
+#define SIMD_TARGET(x) __attribute__((target(x)))
+#else
+#define SIMD_TARGET(x)
+#endif
+
+namespace {
+	SimdLevel detect() {
+#if SIMD_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int max_leaf = info[0];
+		__cpuid(info, 1);
+		bool sse = (info[3] & (1 << 26)) != 0;
+		bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+		unsigned long long xcr = os_avx ? _xgetbv(0) : 0;
+		bool avx2 = false;
+		bool avx512 = false;
+		if (max_leaf >= 7 && (xcr & 6) == 6) {
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+			avx512 = (info[1] & (1 << 16)) != 0 && (xcr & 0xe0) == 0xe0;
+		}
+#else
+		__builtin_cpu_init();
+		bool sse = __builtin_cpu_supports("sse2");
+		bool avx2 = __builtin_cpu_supports("avx2");
+		bool avx512 = __builtin_cpu_supports("avx512f");
+#endif
+		if (avx512) {
+			return SIMD_AVX512;
+		}
+		if (avx2) {
+			return SIMD_AVX2;
+		}
+		if (sse) {
+			return SIMD_SSE;
+		}
+#endif
+		return SIMD_SCALAR;
+	}
+
+	SimdLevel const supported = detect();
+	std::atomic<int> level_cap(SIMD_AVX512);
+
+	float* coordinate(Point_packet const& p, int axis) {
+		return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+	}
+
+	void move_point(Point_packet const& from, size_t i, Point_packet const& to, size_t j) {
+		to.x[j] = from.x[i];
+		to.y[j] = from.y[i];
+		to.z[j] = from.z[i];
+		to.id[j] = from.id[i];
+	}
+
+	size_t partition_scalar(Point_packet const& from, Point_packet const& to, Point_packet const& spill,
+		size_t first, size_t last, int axis, float split, size_t i, size_t& front, size_t& back) {
+		float const* key = coordinate(from, axis);
+		for (; i < last; i++) {
+			if (key[i] >= split) {
+				move_point(from, i, to, front++);
+			}
+			else {
+				move_point(from, i, spill, back++);
+			}
+		}
+		return front - first;
+	}
+
+#if SIMD_X86
+	// lane order that moves the lanes set in an 8 bit mask to the front
+	struct Compress_table {
+		uint32_t lanes[256][8];
+
+		Compress_table() {
+			for (int mask = 0; mask < 256; mask++) {
+				int n = 0;
+				for (int i = 0; i < 8; i++) {
+					if (mask & (1 << i)) {
+						lanes[mask][n++] = i;
+					}
+				}
+				for (int i = 0; i < 8; i++) {
+					if (!(mask & (1 << i))) {
+						lanes[mask][n++] = i;
+					}
+				}
+			}
+		}
+	};
+
+	Compress_table const compress_table;
+
+	SIMD_TARGET("avx2,popcnt")
+	size_t partition_avx2(Point_packet const& from, Point_packet const& to, Point_packet const& spill,
+		size_t first, size_t last, int axis, float split) {
+		float const* key = coordinate(from, axis);
+		__m256 s = _mm256_set1_ps(split);
+		size_t front = first;
+		size_t back = 0;
+		size_t i = first;
+		for (; i + 8 <= last; i += 8) {
+			int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(key + i), s, _CMP_GE_OQ));
+			int taken = _mm_popcnt_u32(mask);
+			__m256i high = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(compress_table.lanes[mask]));
+			__m256i low = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(compress_table.lanes[~mask & 0xff]));
+			float* const src[3] = { from.x, from.y, from.z };
+			float* const dst[3] = { to.x, to.y, to.z };
+			float* const aside[3] = { spill.x, spill.y, spill.z };
+			for (int j = 0; j < 3; j++) {
+				__m256 v = _mm256_loadu_ps(src[j] + i);
+				_mm256_storeu_ps(dst[j] + front, _mm256_permutevar8x32_ps(v, high));
+				_mm256_storeu_ps(aside[j] + back, _mm256_permutevar8x32_ps(v, low));
+			}
+			__m256i id = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(from.id + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(to.id + front), _mm256_permutevar8x32_epi32(id, high));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(spill.id + back), _mm256_permutevar8x32_epi32(id, low));
+			front += taken;
+			back += 8 - taken;
+		}
+		return partition_scalar(from, to, spill, first, last, axis, split, i, front, back);
+	}
+
+	SIMD_TARGET("avx512f,popcnt")
+	size_t partition_avx512(Point_packet const& from, Point_packet const& to, Point_packet const& spill,
+		size_t first, size_t last, int axis, float split) {
+		float const* key = coordinate(from, axis);
+		__m512 s = _mm512_set1_ps(split);
+		size_t front = first;
+		size_t back = 0;
+		size_t i = first;
+		for (; i + 16 <= last; i += 16) {
+			__mmask16 high = _mm512_cmp_ps_mask(_mm512_loadu_ps(key + i), s, _CMP_GE_OQ);
+			__mmask16 low = _mm512_knot(high);
+			float* const src[3] = { from.x, from.y, from.z };
+			float* const dst[3] = { to.x, to.y, to.z };
+			float* const aside[3] = { spill.x, spill.y, spill.z };
+			for (int j = 0; j < 3; j++) {
+				__m512 v = _mm512_loadu_ps(src[j] + i);
+				_mm512_mask_compressstoreu_ps(dst[j] + front, high, v);
+				_mm512_mask_compressstoreu_ps(aside[j] + back, low, v);
+			}
+			__m512i id = _mm512_loadu_si512(from.id + i);
+			_mm512_mask_compressstoreu_epi32(to.id + front, high, id);
+			_mm512_mask_compressstoreu_epi32(spill.id + back, low, id);
+			int taken = _mm_popcnt_u32(high);
+			front += taken;
+			back += 16 - taken;
+		}
+		return partition_scalar(from, to, spill, first, last, axis, split, i, front, back);
+	}
+#endif
+}
+
+Triangle_packet::Triangle_packet() {
+	clear();
+}
+
+void Triangle_packet::clear() {
+	memset(v, 0, sizeof(v));
+	size = 0;
+}
+
+SimdLevel simd_level() {
+	return static_cast<SimdLevel>(std::min<int>(supported, level_cap));
+}
+
+void set_simd_level(SimdLevel level) {
+	level_cap = level;
+}
+
+size_t partition_points(Point_packet const& from, Point_packet const& to, Point_packet const& spill,
+	size_t first, size_t last, int axis, float split) {
+	size_t taken;
+	switch (simd_level()) {
+#if SIMD_X86
+	case SIMD_AVX512:
+		taken = partition_avx512(from, to, spill, first, last, axis, split);
+		break;
+	case SIMD_AVX2:
+		taken = partition_avx2(from, to, spill, first, last, axis, split);
+		break;
+#endif
+	default:
+		size_t front = first;
+		size_t back = 0;
+		taken = partition_scalar(from, to, spill, first, last, axis, split, first, front, back);
+		break;
+	}
+	size_t rest = last - first - taken;
+	size_t at = first + taken;
+	memcpy(to.x + at, spill.x, rest * sizeof(float));
+	memcpy(to.y + at, spill.y, rest * sizeof(float));
+	memcpy(to.z + at, spill.z, rest * sizeof(float));
+	memcpy(to.id + at, spill.id, rest * sizeof(uint32_t));
+	return taken;
+}
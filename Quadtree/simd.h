@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#else
+#define SIMD_X86 0
+#endif
+
+// Instruction sets picked at run time. Every kernel has a scalar version
+// and the vector ones must give exactly the same results.
+enum SimdLevel {
+	SIMD_SCALAR = 0,
+	SIMD_SSE = 1,
+	SIMD_AVX2 = 2,
+	SIMD_AVX512 = 3
+};
+
+// best level supported by this CPU, capped by set_simd_level
+SimdLevel simd_level();
+void set_simd_level(SimdLevel level);
+
+// Points of a batch in structure-of-arrays form together with their
+// positions in the batch.
+struct Point_packet {
+	float* x;
+	float* y;
+	float* z;
+	uint32_t* id;
+};
+
+// Copies the points [first, last) of from whose coordinate along axis is
+// >= split to the front of the same range of to, the others after them.
+// spill is scratch space for at least last - first + 16 points.
+// Returns the number of points moved to the front.
+size_t partition_points(Point_packet const& from, Point_packet const& to, Point_packet const& spill,
+	size_t first, size_t last, int axis, float split);
+
+// Up to 16 triangles stored coordinate by coordinate: v[3 * vertex + axis][i]
+// is one coordinate of triangle i. Unused lanes must stay finite.
+struct Triangle_packet {
+	enum {
+		SIZE = 16
+	};
+
+	alignas(64) float v[9][SIZE];
+	int size;
+
+	Triangle_packet();
+	void clear();
+};
+
+// Separating axis kernels of one instruction set. t is one triangle as
+// a0 a1 a2 b0 b1 b2 c0 c1 c2, box is first0 first1 first2 second0 ... and
+// touch_scale is the 1 - TOUCH_EPS of cross_triangle_box.
+// result[i] is 1 where the packet triangle overlaps. The dispatching
+// versions are cross_triangle_triangles and cross_box_triangles.
+#if SIMD_X86
+void sat_triangles_sse(float const* t, Triangle_packet const& packet, uint8_t* result);
+void sat_triangles_avx2(float const* t, Triangle_packet const& packet, uint8_t* result);
+void sat_triangles_avx512(float const* t, Triangle_packet const& packet, uint8_t* result);
+void sat_box_sse(float const* box, float touch_scale, Triangle_packet const& packet, uint8_t* result);
+void sat_box_avx2(float const* box, float touch_scale, Triangle_packet const& packet, uint8_t* result);
+void sat_box_avx512(float const* box, float touch_scale, Triangle_packet const& packet, uint8_t* result);
+#endif
@@ -0,0 +1,50 @@
+#include "simd.h"
+
+#if SIMD_X86
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx2")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include <immintrin.h>
+#include "sat_kernel.h"
+
+namespace {
+	struct Avx2 {
+		typedef __m256 reg;
+		typedef __m256 mask;
+		enum {
+			WIDTH = 8
+		};
+
+		static reg load(float const* p) { return _mm256_loadu_ps(p); }
+		static reg set1(float x) { return _mm256_set1_ps(x); }
+		static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+		static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+		static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+		static reg min(reg a, reg b) { return _mm256_min_ps(a, b); }
+		static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+		static reg abs(reg a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+		static mask le(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		static mask lt(reg a, reg b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static mask both(mask a, mask b) { return _mm256_and_ps(a, b); }
+		static mask all() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+		static bool none(mask m) { return _mm256_movemask_ps(m) == 0; }
+		static int bits(mask m) { return _mm256_movemask_ps(m); }
+	};
+}
+
+void sat_triangles_avx2(float const* t, Triangle_packet const& packet, uint8_t* result) {
+	sat::triangles<Avx2>(t, packet, result);
+}
+
+void sat_box_avx2(float const* box, float touch_scale, Triangle_packet const& packet, uint8_t* result) {
+	sat::box<Avx2>(box, touch_scale, packet, result);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
@@ -0,0 +1,53 @@
+#include "simd.h"
+
+#if SIMD_X86
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("avx512f")
+// AVX-512 comes with FMA, contracting mul + add would change the results
+#pragma GCC optimize("fp-contract=off")
+// false positive on the undefined registers inside the min/max intrinsics
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+#include "sat_kernel.h"
+
+namespace {
+	struct Avx512 {
+		typedef __m512 reg;
+		typedef __mmask16 mask;
+		enum {
+			WIDTH = 16
+		};
+
+		static reg load(float const* p) { return _mm512_loadu_ps(p); }
+		static reg set1(float x) { return _mm512_set1_ps(x); }
+		static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+		static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+		static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+		static reg min(reg a, reg b) { return _mm512_min_ps(a, b); }
+		static reg max(reg a, reg b) { return _mm512_max_ps(a, b); }
+		static reg abs(reg a) { return _mm512_abs_ps(a); }
+		static mask le(reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+		static mask lt(reg a, reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+		static mask both(mask a, mask b) { return static_cast<mask>(a & b); }
+		static mask all() { return 0xffff; }
+		static bool none(mask m) { return m == 0; }
+		static int bits(mask m) { return m; }
+	};
+}
+
+void sat_triangles_avx512(float const* t, Triangle_packet const& packet, uint8_t* result) {
+	sat::triangles<Avx512>(t, packet, result);
+}
+
+void sat_box_avx512(float const* box, float touch_scale, Triangle_packet const& packet, uint8_t* result) {
+	sat::box<Avx512>(box, touch_scale, packet, result);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
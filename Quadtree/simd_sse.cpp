@@ -0,0 +1,50 @@
+#include "simd.h"
+
+#if SIMD_X86
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC target("sse2")
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include <immintrin.h>
+#include "sat_kernel.h"
+
+namespace {
+	struct Sse {
+		typedef __m128 reg;
+		typedef __m128 mask;
+		enum {
+			WIDTH = 4
+		};
+
+		static reg load(float const* p) { return _mm_loadu_ps(p); }
+		static reg set1(float x) { return _mm_set1_ps(x); }
+		static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+		static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+		static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+		static reg min(reg a, reg b) { return _mm_min_ps(a, b); }
+		static reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+		static reg abs(reg a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+		static mask le(reg a, reg b) { return _mm_cmple_ps(a, b); }
+		static mask lt(reg a, reg b) { return _mm_cmplt_ps(a, b); }
+		static mask both(mask a, mask b) { return _mm_and_ps(a, b); }
+		static mask all() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+		static bool none(mask m) { return _mm_movemask_ps(m) == 0; }
+		static int bits(mask m) { return _mm_movemask_ps(m); }
+	};
+}
+
+void sat_triangles_sse(float const* t, Triangle_packet const& packet, uint8_t* result) {
+	sat::triangles<Sse>(t, packet, result);
+}
+
+void sat_box_sse(float const* box, float touch_scale, Triangle_packet const& packet, uint8_t* result) {
+	sat::box<Sse>(box, touch_scale, packet, result);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
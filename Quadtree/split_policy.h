@@ -0,0 +1,149 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include "geometry.h"
+
+// How Quadtree cuts a node box into children. A policy gives
+//   ARITY         the number of children of an inner node,
+//   STEP          how many halvings one split stands for, heights and
+//                 Build_settings::max_height count halvings whatever
+//                 the policy,
+//   USES_SURFACE  whether plan wants the bounds of the surface in the box,
+//   plan          a small number kept in the node that fixes the cut,
+//   divide        the boxes of the children in the order they are stored,
+//   child         the index of the child whose box holds p.
+// For the two-way policies the plan is the split axis and child 0 is the
+// upper half, the batched queries and Flat_quadtree rely on that.
+
+inline std::pair<Box, Box> divide_box(int h, Box limit) {
+	Point s = (limit.first + limit.second) / 2;
+	Box a = limit;
+	Box b = limit;
+	int cur_d = h % 3;
+	a.first[cur_d] = s[cur_d];
+	b.second[cur_d] = s[cur_d];
+	return std::make_pair(a, b);
+}
+
+// halves along x, y, z in turn
+struct Binary_split {
+	enum {
+		ARITY = 2,
+		STEP = 1,
+		USES_SURFACE = 0
+	};
+
+	static int plan(Box const&, int height, Box const&) {
+		return height % 3;
+	}
+
+	static void divide(Box const& limit, int plan, Box* parts) {
+		auto boxs = divide_box(plan, limit);
+		parts[0] = boxs.first;
+		parts[1] = boxs.second;
+	}
+
+	static int child(Box const& limit, int plan, Point p) {
+		return p[plan] >= (limit.first[plan] + limit.second[plan]) / 2 ? 0 : 1;
+	}
+};
+
+// all three halvings at once, bit k of a child index is set for the
+// lower half along axis k
+struct Octree_split {
+	enum {
+		ARITY = 8,
+		STEP = 3,
+		USES_SURFACE = 0
+	};
+
+	static int plan(Box const&, int, Box const&) {
+		return 0;
+	}
+
+	static void divide(Box const& limit, int, Box* parts) {
+		Point s = (limit.first + limit.second) / 2;
+		for (int i = 0; i < ARITY; i++) {
+			parts[i] = limit;
+			for (int k = 0; k < 3; k++) {
+				if (i >> k & 1) {
+					parts[i].second[k] = s[k];
+				}
+				else {
+					parts[i].first[k] = s[k];
+				}
+			}
+		}
+	}
+
+	static int child(Box const& limit, int, Point p) {
+		int result = 0;
+		for (int k = 0; k < 3; k++) {
+			if (!(p[k] >= (limit.first[k] + limit.second[k]) / 2)) {
+				result |= 1 << k;
+			}
+		}
+		return result;
+	}
+};
+
+// Halves along the axis that leaves the least surface area of boxes
+// still crossed by the surface, the cheap end of a SAH. A flat plate is
+// cut across first and the empty side is done at once. Axes shorter than
+// half the longest side are left out so thin boxes still get cut along
+// their length, ties keep the x, y, z cycle.
+struct Adaptive_split {
+	enum {
+		ARITY = 2,
+		STEP = 1,
+		USES_SURFACE = 1
+	};
+
+	static float area(Box const& box) {
+		Point d = box.second - box.first;
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	}
+
+	static bool touches(Box const& a, Box const& b) {
+		for (int j = 0; j < 3; j++) {
+			if (a.second[j] < b.first[j] || b.second[j] < a.first[j]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static int plan(Box const& limit, int height, Box const& surface) {
+		Point size = limit.second - limit.first;
+		float longest = std::max(size.x, std::max(size.y, size.z));
+		int best = -1;
+		float best_cost = 0;
+		for (int k = 0; k < 3; k++) {
+			int d = (height + k) % 3;
+			if (size[d] * 2 < longest) {
+				continue;
+			}
+			Box parts[ARITY];
+			divide(limit, d, parts);
+			float cost = 0;
+			for (Box const& part : parts) {
+				if (touches(part, surface)) {
+					cost += area(part);
+				}
+			}
+			if (best < 0 || cost < best_cost) {
+				best = d;
+				best_cost = cost;
+			}
+		}
+		return best;
+	}
+
+	static void divide(Box const& limit, int plan, Box* parts) {
+		Binary_split::divide(limit, plan, parts);
+	}
+
+	static int child(Box const& limit, int plan, Point p) {
+		return Binary_split::child(limit, plan, p);
+	}
+};
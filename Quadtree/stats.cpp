@@ -0,0 +1,302 @@
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace {
+bool fail(std::string* error, std::string const& message) {
+	if (error != nullptr) {
+		*error = message;
+	}
+	return false;
+}
+}
+
+char const* stat_name(StatCounter counter) {
+	static char const* const names[COUNTER_COUNT] = {
+		"cross_calls",
+		"sat_box_tests",
+		"sat_triangle_tests",
+		"contains_calls",
+		"candidate_queries",
+		"max_height_cuts"
+	};
+	return names[counter];
+}
+
+char const* stat_name(StatPhase phase) {
+	static char const* const names[PHASE_COUNT] = {
+		"build",
+		"gather",
+		"classify",
+		"payload"
+	};
+	return names[phase];
+}
+
+Quadtree_stats::Quadtree_stats() :
+	counters(),
+	phase_calls(),
+	phase_seconds(),
+	nodes() { }
+
+Quadtree_stats& Quadtree_stats::operator+=(Quadtree_stats const& b) {
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		counters[i] += b.counters[i];
+	}
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		phase_calls[i] += b.phase_calls[i];
+		phase_seconds[i] += b.phase_seconds[i];
+	}
+	for (int h = 0; h < MAX_HEIGHT; h++) {
+		for (int t = 0; t < 3; t++) {
+			nodes[h][t] += b.nodes[h][t];
+		}
+	}
+	return *this;
+}
+
+bool stats_compiled_in() {
+	return QUADTREE_STATS != 0;
+}
+
+#if QUADTREE_STATS
+namespace {
+const size_t MAX_EVENTS = 1 << 20;  // per thread, later ones are dropped
+
+struct Trace_event {
+	char const* name;
+	int height;
+	int64_t start;     // ns since the trace started
+	int64_t duration;  // ns
+};
+
+// Every thread counts into its own block, get_stats sums them. A thread
+// that ends leaves its numbers behind in the registry.
+struct Thread_stats {
+	Quadtree_stats stats;
+	std::vector<Trace_event> events;
+	uint64_t dropped;
+	int id;
+	int current;  // height of the innermost traced subtree, -1 outside one
+
+	Thread_stats();
+	~Thread_stats();
+};
+
+struct Registry {
+	std::mutex lock;
+	std::vector<Thread_stats*> threads;
+	Quadtree_stats retired;
+	std::vector<std::pair<int, Trace_event> > retired_events;
+	uint64_t retired_dropped = 0;
+	int next_id = 1;
+	std::atomic<bool> tracing{ false };
+	std::atomic<int> trace_height{ 8 };
+	std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+Registry& registry() {
+	static Registry instance;
+	return instance;
+}
+
+Thread_stats::Thread_stats() :
+	dropped(0),
+	current(-1) {
+	Registry& r = registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	id = r.next_id++;
+	r.threads.push_back(this);
+}
+
+Thread_stats::~Thread_stats() {
+	Registry& r = registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	r.retired += stats;
+	for (Trace_event const& e : events) {
+		r.retired_events.push_back(std::make_pair(id, e));
+	}
+	r.retired_dropped += dropped;
+	r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+}
+
+Thread_stats& local() {
+	thread_local Thread_stats stats;
+	return stats;
+}
+
+int64_t now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()
+		- registry().epoch).count();
+}
+
+void record(Thread_stats& t, char const* name, int height, int64_t start) {
+	if (t.events.size() >= MAX_EVENTS) {
+		t.dropped++;
+		return;
+	}
+	t.events.push_back(Trace_event{ name, height, start, now() - start });
+}
+}
+
+void stats_count(StatCounter counter, uint64_t n) {
+	local().stats.counters[counter] += n;
+}
+
+void stats_node(int height, int type) {
+	int h = std::min(std::max(height, 0), static_cast<int>(Quadtree_stats::MAX_HEIGHT) - 1);
+	local().stats.nodes[h][type - 1]++;
+}
+
+Stats_phase::Stats_phase(StatPhase phase) :
+	phase(phase),
+	start(now()) { }
+
+Stats_phase::~Stats_phase() {
+	Thread_stats& t = local();
+	int64_t end = now();
+	t.stats.phase_calls[phase]++;
+	t.stats.phase_seconds[phase] += (end - start) * 1e-9;
+	if (registry().tracing.load(std::memory_order_relaxed) && (phase == BUILD_PHASE || t.current >= 0)) {
+		record(t, stat_name(phase), t.current, start);
+	}
+}
+
+Stats_subtree::Stats_subtree(int height) :
+	height(height),
+	start(0) {
+	Thread_stats& t = local();
+	outer = t.current;
+	bool traced = registry().tracing.load(std::memory_order_relaxed)
+		&& height <= registry().trace_height.load(std::memory_order_relaxed);
+	t.current = traced ? height : -1;
+	if (traced) {
+		start = now();
+	}
+}
+
+Stats_subtree::~Stats_subtree() {
+	Thread_stats& t = local();
+	if (t.current >= 0) {
+		record(t, "subtree", height, start);
+	}
+	t.current = outer;
+}
+
+Quadtree_stats get_stats() {
+	Registry& r = registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	Quadtree_stats sum = r.retired;
+	for (Thread_stats const* t : r.threads) {
+		sum += t->stats;
+	}
+	return sum;
+}
+
+void reset_stats() {
+	Registry& r = registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	r.retired = Quadtree_stats();
+	for (Thread_stats* t : r.threads) {
+		t->stats = Quadtree_stats();
+	}
+}
+
+void start_trace(int max_height) {
+	Registry& r = registry();
+	{
+		std::lock_guard<std::mutex> guard(r.lock);
+		r.retired_events.clear();
+		r.retired_dropped = 0;
+		for (Thread_stats* t : r.threads) {
+			t->events.clear();
+			t->dropped = 0;
+		}
+	}
+	r.trace_height = max_height;
+	r.tracing = true;
+}
+
+void stop_trace() {
+	registry().tracing = false;
+}
+
+bool write_trace(std::string const& path, std::string* error) {
+	Registry& r = registry();
+	std::vector<std::pair<int, Trace_event> > events;
+	uint64_t dropped;
+	{
+		std::lock_guard<std::mutex> guard(r.lock);
+		events = r.retired_events;
+		dropped = r.retired_dropped;
+		for (Thread_stats const* t : r.threads) {
+			for (Trace_event const& e : t->events) {
+				events.push_back(std::make_pair(t->id, e));
+			}
+			dropped += t->dropped;
+		}
+	}
+	Quadtree_stats stats = get_stats();
+
+	std::ofstream out(path.c_str(), std::ios::trunc);
+	if (!out) {
+		return fail(error, "can't create " + path);
+	}
+	char line[256];
+	out << "{\"traceEvents\":[";
+	for (size_t i = 0; i < events.size(); i++) {
+		Trace_event const& e = events[i].second;
+		snprintf(line, sizeof(line), "%s\n{\"name\":\"%s\",\"cat\":\"quadtree\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"height\":%d}}", i == 0 ? "" : ",", e.name, events[i].first,
+			e.start * 1e-3, e.duration * 1e-3, e.height);
+		out << line;
+	}
+	out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":" << dropped << ",\"counters\":{";
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		out << (i == 0 ? "" : ",") << '"' << stat_name(static_cast<StatCounter>(i)) << "\":" << stats.counters[i];
+	}
+	out << "},\"phases\":{";
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		snprintf(line, sizeof(line), "%s\"%s\":{\"calls\":%llu,\"seconds\":%.9g}", i == 0 ? "" : ",",
+			stat_name(static_cast<StatPhase>(i)), static_cast<unsigned long long>(stats.phase_calls[i]),
+			stats.phase_seconds[i]);
+		out << line;
+	}
+	// [height, empty, full, no_empty] for every height that has boxes
+	out << "},\"nodes\":[";
+	bool first = true;
+	for (int h = 0; h < Quadtree_stats::MAX_HEIGHT; h++) {
+		uint64_t const* n = stats.nodes[h];
+		if (n[0] + n[1] + n[2] == 0) {
+			continue;
+		}
+		out << (first ? "" : ",") << '[' << h << ',' << n[0] << ',' << n[1] << ',' << n[2] << ']';
+		first = false;
+	}
+	out << "]}}\n";
+	out.close();
+	if (!out) {
+		return fail(error, "can't write " + path);
+	}
+	return true;
+}
+#else
+Quadtree_stats get_stats() {
+	return Quadtree_stats();
+}
+
+void reset_stats() { }
+
+void start_trace(int) { }
+
+void stop_trace() { }
+
+bool write_trace(std::string const& path, std::string* error) {
+	return fail(error, "can't trace to " + path + ", the build has no QUADTREE_STATS");
+}
+#endif
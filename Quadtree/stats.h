@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Counters, histograms and timers of the tree build, for finding out
+// where a slow build spends its time. They are compiled in only with
+// QUADTREE_STATS=1 (the CMake option of the same name). Otherwise every
+// QT_ macro below expands to nothing and get_stats() returns zeros.
+#ifndef QUADTREE_STATS
+#define QUADTREE_STATS 0
+#endif
+
+enum StatCounter {
+	CROSS_CALLS,         // Object::cross
+	SAT_BOX_TESTS,       // triangle-box separating axis tests, a packet lane each
+	SAT_TRIANGLE_TESTS,  // triangle-triangle tests, a packet lane each
+	CONTAINS_CALLS,      // Object::contains
+	CANDIDATE_QUERIES,   // Object::candidates, a BVH walk each
+	MAX_HEIGHT_CUTS,     // boxes still crossed by a surface below Build_settings::max_height
+	COUNTER_COUNT
+};
+
+enum StatPhase {
+	BUILD_PHASE,     // a build or an update_object
+	GATHER_PHASE,    // the candidate triangles of a box
+	CLASSIFY_PHASE,  // test_for_in_out of a box
+	PAYLOAD_PHASE,   // T::get_value or T::get_surface_value of a leaf
+	PHASE_COUNT
+};
+
+char const* stat_name(StatCounter counter);
+char const* stat_name(StatPhase phase);
+
+struct Quadtree_stats {
+	enum {
+		MAX_HEIGHT = 64  // deeper boxes are counted at MAX_HEIGHT - 1
+	};
+
+	Quadtree_stats();
+
+	uint64_t counters[COUNTER_COUNT];
+	uint64_t phase_calls[PHASE_COUNT];
+	// a phase inside another one counts in both
+	double phase_seconds[PHASE_COUNT];
+	// boxes classified at each height, indexed by NodeType - 1: EMPTY
+	// boxes are pruned subtrees, FULL ones zones and NO_EMPTY ones are
+	// split further unless they are below the maximum height
+	uint64_t nodes[MAX_HEIGHT][3];
+
+	Quadtree_stats& operator+=(Quadtree_stats const& b);
+};
+
+bool stats_compiled_in();
+// the sum over every thread since the last reset, read it while no
+// build is running
+Quadtree_stats get_stats();
+void reset_stats();
+
+// While a trace runs, every subtree of the build rooted at most
+// max_height deep becomes an event of the thread that built it, with the
+// phases inside it as nested events. write_trace stores them as Chrome
+// trace JSON (chrome://tracing, ui.perfetto.dev) with get_stats() under
+// otherData. Fails when the stats are compiled out.
+void start_trace(int max_height = 8);
+void stop_trace();
+bool write_trace(std::string const& path, std::string* error = nullptr);
+
+#if QUADTREE_STATS
+void stats_count(StatCounter counter, uint64_t n);
+void stats_node(int height, int type);
+
+// times a phase for as long as it lives
+class Stats_phase {
+	StatPhase phase;
+	int64_t start;
+
+public:
+	explicit Stats_phase(StatPhase phase);
+	~Stats_phase();
+	Stats_phase(Stats_phase const&) = delete;
+	Stats_phase& operator=(Stats_phase const&) = delete;
+};
+
+// marks the building of a subtree for the trace
+class Stats_subtree {
+	int height;
+	int outer;
+	int64_t start;
+
+public:
+	explicit Stats_subtree(int height);
+	~Stats_subtree();
+	Stats_subtree(Stats_subtree const&) = delete;
+	Stats_subtree& operator=(Stats_subtree const&) = delete;
+};
+
+#define QT_STATS_CONCAT2(a, b) a##b
+#define QT_STATS_CONCAT(a, b) QT_STATS_CONCAT2(a, b)
+#define QT_COUNT(counter, n) stats_count(counter, n)
+#define QT_NODE(height, type) stats_node(height, type)
+#define QT_PHASE(phase) Stats_phase QT_STATS_CONCAT(stats_phase_, __LINE__)(phase)
+#define QT_SUBTREE(height) Stats_subtree QT_STATS_CONCAT(stats_subtree_, __LINE__)(height)
+#else
+#define QT_COUNT(counter, n) ((void)0)
+#define QT_NODE(height, type) ((void)0)
+#define QT_PHASE(phase) ((void)0)
+#define QT_SUBTREE(height) ((void)0)
+#endif
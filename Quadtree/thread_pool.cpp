@@ -0,0 +1,143 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+	thread_local Thread_pool const* owner = nullptr;
+	thread_local int owner_queue = 0;
+}
+
+Task_group::Task_group(Thread_pool& pool) :
+	pool(pool),
+	pending(0) { }
+
+Task_group::~Task_group() {
+	wait();
+}
+
+void Task_group::run(std::function<void()> task) {
+	pending++;
+	pool.push({ std::move(task), this });
+}
+
+void Task_group::wait() {
+	while (pending > 0) {
+		if (!pool.try_run()) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+Thread_pool::Thread_pool(int threads) :
+	queued(0),
+	stop(false) {
+	if (threads <= 0) {
+		threads = hardware_threads();
+	}
+	for (int i = 0; i < threads; i++) {
+		queues.emplace_back(new Queue());
+	}
+	for (int i = 1; i < threads; i++) {
+		workers.emplace_back(&Thread_pool::worker, this, i);
+	}
+}
+
+Thread_pool::~Thread_pool() {
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		stop = true;
+	}
+	wake.notify_all();
+	for (auto& v : workers) {
+		v.join();
+	}
+}
+
+int Thread_pool::size() const {
+	return static_cast<int>(queues.size());
+}
+
+int Thread_pool::hardware_threads() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+int Thread_pool::current_queue() const {
+	return owner == this ? owner_queue : 0;
+}
+
+void Thread_pool::push(Task task) {
+	Queue& queue = *queues[current_queue()];
+	{
+		std::lock_guard<std::mutex> guard(queue.lock);
+		queue.tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock);
+		queued++;
+	}
+	wake.notify_one();
+}
+
+bool Thread_pool::try_run() {
+	int self = current_queue();
+	int n = size();
+	for (int i = 0; i < n; i++) {
+		int id = (self + i) % n;
+		Queue& queue = *queues[id];
+		Task task;
+		{
+			std::lock_guard<std::mutex> guard(queue.lock);
+			if (queue.tasks.empty()) {
+				continue;
+			}
+			// own tasks depth first, stolen tasks from the other end
+			if (id == self) {
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+			}
+			else {
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+			}
+		}
+		queued--;
+		task.run();
+		task.group->pending--;
+		return true;
+	}
+	return false;
+}
+
+void Thread_pool::worker(int id) {
+	owner = this;
+	owner_queue = id;
+	while (true) {
+		if (try_run()) {
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(sleep_lock);
+		wake.wait_for(guard, std::chrono::milliseconds(1), [this] {
+			return stop || queued > 0;
+		});
+		if (stop) {
+			return;
+		}
+	}
+}
+
+void Thread_pool::parallel_for(size_t n, size_t chunk, std::function<void(size_t, size_t)> const& f) {
+	chunk = std::max<size_t>(1, chunk);
+	Task_group group(*this);
+	for (size_t first = 0; first < n; first += chunk) {
+		size_t last = std::min(n, first + chunk);
+		if (last == n) {
+			f(first, last);
+		}
+		else {
+			group.run([&f, first, last] {
+				f(first, last);
+			});
+		}
+	}
+	group.wait();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Thread_pool;
+
+// Set of tasks the spawning thread can wait for. While waiting it keeps
+// running queued tasks, so nested groups never block a worker.
+class Task_group {
+	Thread_pool& pool;
+	std::atomic<int> pending;
+
+	friend class Thread_pool;
+public:
+	explicit Task_group(Thread_pool& pool);
+	~Task_group();
+
+	void run(std::function<void()> task);
+	void wait();
+};
+
+// Work-stealing pool: each worker owns a deque, pushes and pops at the
+// back and steals from the front of the others. The thread that created
+// the pool takes part through slot 0 whenever it waits on a group.
+class Thread_pool {
+	struct Task {
+		std::function<void()> run;
+		Task_group* group;
+	};
+
+	struct Queue {
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue> > queues;
+	std::vector<std::thread> workers;
+	std::atomic<int> queued;
+	std::atomic<bool> stop;
+	std::mutex sleep_lock;
+	std::condition_variable wake;
+
+	int current_queue() const;
+	void push(Task task);
+	bool try_run();
+	void worker(int id);
+
+	friend class Task_group;
+public:
+	// threads <= 0 uses every hardware thread
+	explicit Thread_pool(int threads);
+	~Thread_pool();
+
+	int size() const;
+
+	// calls f(first, last) over [0, n) split into chunks of at most chunk
+	void parallel_for(size_t n, size_t chunk, std::function<void(size_t, size_t)> const& f);
+
+	static int hardware_threads();
+};
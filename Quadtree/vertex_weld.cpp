@@ -0,0 +1,234 @@
+#include "vertex_weld.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace {
+const uint32_t NONE = UINT32_MAX;
+// corners per slab the parallel welding aims for
+const size_t SLAB_SIZE = 1 << 15;
+
+struct Cell {
+	int32_t x, y, z;
+};
+
+bool operator==(Cell const& a, Cell const& b) {
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Open addressing map from a grid cell to the last representative put in
+// it, the others are chained through next. Grows at half load.
+class Cell_table {
+	struct entry {
+		Cell cell;
+		uint32_t head;
+	};
+
+	std::vector<entry> entries;
+	size_t used;
+
+	static size_t hash(Cell const& c) {
+		uint64_t h = static_cast<uint64_t>(static_cast<uint32_t>(c.x)) * 0x9E3779B97F4A7C15ull;
+		h ^= static_cast<uint64_t>(static_cast<uint32_t>(c.y)) * 0xC2B2AE3D27D4EB4Full;
+		h ^= static_cast<uint64_t>(static_cast<uint32_t>(c.z)) * 0x165667B19E3779F9ull;
+		return static_cast<size_t>(h ^ (h >> 32));
+	}
+
+	size_t slot(Cell const& c) const {
+		size_t mask = entries.size() - 1;
+		size_t i = hash(c) & mask;
+		while (entries[i].head != NONE && !(entries[i].cell == c)) {
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+
+public:
+	explicit Cell_table(size_t capacity) :
+		used(0) {
+		size_t size = 16;
+		while (size < 2 * capacity) {
+			size *= 2;
+		}
+		entries.assign(size, entry{ Cell{ 0, 0, 0 }, NONE });
+	}
+
+	uint32_t find(Cell const& c) const {
+		return entries[slot(c)].head;
+	}
+
+	// makes corner the head of its cell, returns the previous head
+	uint32_t push(Cell const& c, uint32_t corner) {
+		size_t i = slot(c);
+		uint32_t previous = entries[i].head;
+		if (previous == NONE) {
+			if (2 * (used + 1) > entries.size()) {
+				std::vector<entry> old(2 * entries.size(), entry{ Cell{ 0, 0, 0 }, NONE });
+				old.swap(entries);
+				for (entry const& e : old) {
+					if (e.head != NONE) {
+						entries[slot(e.cell)] = e;
+					}
+				}
+				i = slot(c);
+			}
+			used++;
+		}
+		entries[i].cell = c;
+		entries[i].head = corner;
+		return previous;
+	}
+};
+
+struct Welder {
+	std::vector<Triangle> const& triangles;
+	float eps;
+	std::vector<Cell> cells;
+	// representative of every corner, a representative is its own
+	std::vector<uint32_t> owner;
+	// next representative in the same cell
+	std::vector<uint32_t> next;
+
+	Welder(std::vector<Triangle> const& triangles, float eps) :
+		triangles(triangles),
+		eps(eps),
+		cells(3 * triangles.size()),
+		owner(3 * triangles.size(), NONE),
+		next(3 * triangles.size(), NONE) { }
+
+	Point corner(uint32_t i) const {
+		return triangles[i / 3].points[i % 3];
+	}
+
+	// Cells are 2 eps wide, so per axis a close vertex is in the cell of p
+	// or in the neighbour on the side of the half p lies in.
+	Cell cell_of(Point p) const {
+		int32_t c[3];
+		for (int k = 0; k < 3; k++) {
+			c[k] = grid(p[k]);
+		}
+		return Cell{ c[0], c[1], c[2] };
+	}
+
+	int32_t grid(float v) const {
+		double cell = std::floor(v / (2.0 * eps));
+		return static_cast<int32_t>(std::max<double>(INT32_MIN + 1, std::min<double>(INT32_MAX - 1, cell)));
+	}
+
+	// first representative of table close to p, its own cell is tried first
+	uint32_t match(Cell_table const& table, Cell c, Point p) const {
+		int32_t side[3];
+		for (int k = 0; k < 3; k++) {
+			side[k] = p[k] / (2.0 * eps) - std::floor(p[k] / (2.0 * eps)) < 0.5 ? -1 : 1;
+		}
+		for (int mask = 0; mask < 8; mask++) {
+			Cell near = Cell{
+				c.x + (mask & 1 ? side[0] : 0),
+				c.y + (mask & 2 ? side[1] : 0),
+				c.z + (mask & 4 ? side[2] : 0)
+			};
+			for (uint32_t r = table.find(near); r != NONE; r = next[r]) {
+				if (corner(r) == p) {
+					return r;
+				}
+			}
+		}
+		return NONE;
+	}
+
+	// welds the corners of one slab, reps of the neighbour slabs are
+	// already final and are preferred over new ones
+	void weld(std::vector<uint32_t> const& slab, Cell_table& table,
+		Cell_table const* before, Cell_table const* after) {
+		for (uint32_t i : slab) {
+			Point p = corner(i);
+			uint32_t r = NONE;
+			if (before != nullptr) {
+				r = match(*before, cells[i], p);
+			}
+			if (r == NONE && after != nullptr) {
+				r = match(*after, cells[i], p);
+			}
+			if (r == NONE) {
+				r = match(table, cells[i], p);
+			}
+			if (r == NONE) {
+				r = i;
+				next[i] = table.push(cells[i], i);
+			}
+			owner[i] = r;
+		}
+	}
+};
+}
+
+void weld_vertices(std::vector<Triangle> const& triangles, float eps, Indexed_mesh& mesh,
+	Thread_pool* pool) {
+	Welder welder(triangles, eps);
+	size_t n = welder.cells.size();
+	mesh.vertices = Point_batch();
+	mesh.indices.assign(n, 0);
+	if (n == 0) {
+		return;
+	}
+	auto find_cells = [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; i++) {
+			welder.cells[i] = welder.cell_of(welder.corner(static_cast<uint32_t>(i)));
+		}
+	};
+	if (pool == nullptr) {
+		find_cells(0, n);
+	}
+	else {
+		pool->parallel_for(n, SLAB_SIZE, find_cells);
+	}
+	int64_t low = INT32_MAX;
+	int64_t high = INT32_MIN;
+	for (Cell const& c : welder.cells) {
+		low = std::min<int64_t>(low, c.x);
+		high = std::max<int64_t>(high, c.x);
+	}
+
+	// Slabs are at least one cell wide, so the neighbours of a corner lie
+	// in its own slab or the two next to it. Even slabs are welded first
+	// and independently, then the odd ones against them.
+	size_t slabs = pool == nullptr ? 1 : std::max<size_t>(1, std::min<size_t>(n / SLAB_SIZE,
+		static_cast<size_t>(std::min<int64_t>(high - low + 1, 1 << 16))));
+	int64_t width = (high - low) / static_cast<int64_t>(slabs) + 1;
+	std::vector<std::vector<uint32_t> > members(slabs);
+	for (uint32_t i = 0; i < n; i++) {
+		members[static_cast<size_t>((welder.cells[i].x - low) / width)].push_back(i);
+	}
+	std::vector<Cell_table> tables;
+	tables.reserve(slabs);
+	for (size_t s = 0; s < slabs; s++) {
+		tables.push_back(Cell_table(members[s].size() / 4));
+	}
+	if (slabs == 1) {
+		welder.weld(members[0], tables[0], nullptr, nullptr);
+	}
+	else {
+		for (size_t parity = 0; parity < 2; parity++) {
+			pool->parallel_for((slabs + 1 - parity) / 2, 1, [&](size_t first, size_t last) {
+				for (size_t k = first; k < last; k++) {
+					size_t s = 2 * k + parity;
+					Cell_table const* before = parity == 1 ? &tables[s - 1] : nullptr;
+					Cell_table const* after = parity == 1 && s + 1 < slabs ? &tables[s + 1] : nullptr;
+					welder.weld(members[s], tables[s], before, after);
+				}
+			});
+		}
+	}
+
+	// number the representatives in order of first use
+	std::vector<uint32_t> number(n, NONE);
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t r = welder.owner[i];
+		if (number[r] == NONE) {
+			number[r] = static_cast<uint32_t>(mesh.vertices.size());
+			mesh.vertices.push_back(welder.corner(r));
+		}
+		mesh.indices[i] = number[r];
+	}
+}
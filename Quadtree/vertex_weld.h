@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+
+class Thread_pool;
+
+// Merges triangle corners that are closer than eps in every coordinate,
+// the same test as operator== on points. The merged points go to the
+// vertices of mesh in order of first use, with three indices per triangle.
+// Corners are hashed into a grid of cell size 2 eps, so a corner is only
+// compared with the vertices of the 8 cells around it. With a pool the
+// grid is cut into slabs along x that are welded in parallel, the result
+// does not depend on the number of threads.
+void weld_vertices(std::vector<Triangle> const& triangles, float eps, Indexed_mesh& mesh,
+	Thread_pool* pool = nullptr);
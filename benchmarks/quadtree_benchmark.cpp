@@ -0,0 +1,295 @@
+// Benchmarks of the tree build, point queries and geometry kernels on
+// synthetic meshes. Results go to quadtree_benchmark.json unless
+// --benchmark_out says otherwise; --max_triangles=N leaves out the larger
+// meshes, the sizes run from 1k to 10M triangles.
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "physical_quadtree.h"
+#include "split_policy.h"
+#include "stats.h"
+#include "synthetic_mesh.h"
+
+namespace {
+const size_t QUERIES = 1 << 16;
+
+// one mesh with everything the benchmarks on it need, the tree is built
+// when first asked for
+struct Fixture {
+	MeshShape shape;
+	size_t count;
+	std::unique_ptr<Scene> scene;
+	Box limit;
+	Physical_quadtree::node_pool arena;
+	std::unique_ptr<Physical_quadtree> tree;
+	std::vector<Point> points;  // uniform over limit
+
+	Physical_quadtree const& get_tree() {
+		if (tree == nullptr) {
+			Build_settings settings;
+			settings.threads = 0;
+			tree.reset(new Physical_quadtree(*scene, limit, 0.5f, settings, &arena));
+		}
+		return *tree;
+	}
+};
+
+// Only the fixture of the last mesh is kept, the benchmarks are
+// registered mesh by mesh so every mesh is made once.
+Fixture& get_fixture(MeshShape shape, size_t count) {
+	static std::unique_ptr<Fixture> last;
+	if (last == nullptr || last->shape != shape || last->count != count) {
+		last.reset();
+		last.reset(new Fixture());
+		last->shape = shape;
+		last->count = count;
+		std::vector<PObject> objects;
+		objects.push_back(PObject(make_mesh(shape, count), 1));
+		last->scene.reset(new Scene(std::move(objects)));
+		// a little room around the mesh, as a real domain has
+		last->limit = Box(Point(-1.1f, -1.1f, -1.1f), Point(1.1f, 1.1f, 1.1f));
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> u(-1.1f, 1.1f);
+		for (size_t i = 0; i < QUERIES; i++) {
+			last->points.push_back(Point(u(random), u(random), u(random)));
+		}
+	}
+	return *last;
+}
+
+void set_mesh_counters(benchmark::State& state, Fixture& fixture) {
+	state.counters["triangles"] = static_cast<double>(fixture.scene->get(0).size());
+}
+
+void build(benchmark::State& state, MeshShape shape, size_t count) {
+	Fixture& fixture = get_fixture(shape, count);
+	Build_settings settings;
+	settings.threads = 1;
+	Physical_quadtree::node_pool arena;
+	size_t nodes = 0;
+	size_t zones = 0;
+	reset_stats();
+	for (auto _ : state) {
+		std::unique_ptr<Physical_quadtree> tree(new Physical_quadtree(*fixture.scene, fixture.limit, 0.5f, settings,
+			&arena));
+		state.PauseTiming();
+		nodes = arena.size();
+		zones = tree->get_zones().size();
+		tree.reset();
+		state.ResumeTiming();
+	}
+	set_mesh_counters(state, fixture);
+	state.counters["nodes"] = static_cast<double>(nodes);
+	state.counters["zones"] = static_cast<double>(zones);
+	if (stats_compiled_in()) {
+		// per build, the counters cost time of their own
+		Quadtree_stats stats = get_stats();
+		for (StatCounter c : { CROSS_CALLS, SAT_BOX_TESTS, CONTAINS_CALLS, CANDIDATE_QUERIES, MAX_HEIGHT_CUTS }) {
+			state.counters[stat_name(c)] = static_cast<double>(stats.counters[c]) / state.iterations();
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * fixture.scene->get(0).size());
+}
+
+void is_empty_point(benchmark::State& state, MeshShape shape, size_t count) {
+	Fixture& fixture = get_fixture(shape, count);
+	Physical_quadtree const& tree = fixture.get_tree();
+	size_t empty = 0;
+	for (auto _ : state) {
+		for (Point p : fixture.points) {
+			empty += tree.is_empty_point(p);
+		}
+	}
+	benchmark::DoNotOptimize(empty);
+	set_mesh_counters(state, fixture);
+	state.SetItemsProcessed(state.iterations() * fixture.points.size());
+}
+
+void is_empty_points(benchmark::State& state, MeshShape shape, size_t count) {
+	Fixture& fixture = get_fixture(shape, count);
+	Physical_quadtree const& tree = fixture.get_tree();
+	Point_batch batch(fixture.points);
+	std::vector<uint8_t> result(batch.size());
+	for (auto _ : state) {
+		tree.is_empty_points(batch, result.data());
+		benchmark::ClobberMemory();
+	}
+	set_mesh_counters(state, fixture);
+	state.SetItemsProcessed(state.iterations() * batch.size());
+}
+
+// triangles of the mesh against copies of others moved by a fraction of
+// their size, so about half the pairs cross
+std::vector<Triangle> shifted_pairs(Object const& object, std::vector<Triangle>& others) {
+	std::mt19937 random(3);
+	std::uniform_int_distribution<size_t> pick(0, object.size() - 1);
+	std::uniform_real_distribution<float> shift(-0.5f, 0.5f);
+	std::vector<Triangle> triangles;
+	for (size_t i = 0; i < 4096; i++) {
+		Triangle t = object.triangle(pick(random));
+		Triangle s = object.triangle(pick(random));
+		Point centre = (t.points[0] + t.points[1] + t.points[2]) / 3;
+		Point from = (s.points[0] + s.points[1] + s.points[2]) / 3;
+		Point edge = t.points[1] - t.points[0];
+		float size = sqrt(dot_product(edge, edge));
+		Point move = centre - from + Point(shift(random), shift(random), shift(random)) * size;
+		for (Point& p : s.points) {
+			p = p + move;
+		}
+		triangles.push_back(t);
+		others.push_back(s);
+	}
+	return triangles;
+}
+
+void cross_triangle_triangle(benchmark::State& state, MeshShape shape, size_t count) {
+	Fixture& fixture = get_fixture(shape, count);
+	std::vector<Triangle> others;
+	std::vector<Triangle> triangles = shifted_pairs(fixture.scene->get(0), others);
+	size_t crossed = 0;
+	for (auto _ : state) {
+		for (size_t i = 0; i < triangles.size(); i++) {
+			crossed += cross_triangle_triangle(triangles[i], others[i]);
+		}
+	}
+	benchmark::DoNotOptimize(crossed);
+	state.counters["crossing"] = static_cast<double>(crossed) / (state.iterations() * triangles.size());
+	state.SetItemsProcessed(state.iterations() * triangles.size());
+}
+
+// the same pairs through the vector kernel, a packet of others per triangle
+void cross_triangle_triangles(benchmark::State& state, MeshShape shape, size_t count) {
+	Fixture& fixture = get_fixture(shape, count);
+	std::vector<Triangle> others;
+	std::vector<Triangle> triangles = shifted_pairs(fixture.scene->get(0), others);
+	const size_t width = Triangle_packet::SIZE;
+	std::vector<Triangle_packet> packets(triangles.size() / width);
+	for (size_t i = 0; i < packets.size() * width; i++) {
+		add_to_packet(packets[i / width], others[i]);
+	}
+	uint8_t result[width];
+	for (auto _ : state) {
+		for (size_t i = 0; i < packets.size(); i++) {
+			cross_triangle_triangles(triangles[i * width], packets[i], result);
+			benchmark::DoNotOptimize(result);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * packets.size() * width);
+}
+
+// one point per iteration, the time per iteration is the latency
+void object_contains(benchmark::State& state, MeshShape shape, size_t count) {
+	Fixture& fixture = get_fixture(shape, count);
+	Object const& object = fixture.scene->get(0);
+	size_t i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(object.contains(fixture.points[i]));
+		i = (i + 1) % fixture.points.size();
+	}
+	set_mesh_counters(state, fixture);
+	state.SetItemsProcessed(state.iterations());
+}
+
+// boxes of a sixteenth of the domain, about the size of the nodes a
+// build tests most
+void object_cross(benchmark::State& state, MeshShape shape, size_t count) {
+	Fixture& fixture = get_fixture(shape, count);
+	Object const& object = fixture.scene->get(0);
+	Point half(2.2f / 32, 2.2f / 32, 2.2f / 32);
+	size_t i = 0;
+	for (auto _ : state) {
+		Point p = fixture.points[i];
+		benchmark::DoNotOptimize(object.cross(Box(p - half, p + half)));
+		i = (i + 1) % fixture.points.size();
+	}
+	set_mesh_counters(state, fixture);
+	state.SetItemsProcessed(state.iterations());
+}
+
+void divide(benchmark::State& state) {
+	Box box(Point(-1, -1, -1), Point(1, 1, 1));
+	int h = 0;
+	for (auto _ : state) {
+		auto parts = divide_box(h, box);
+		benchmark::DoNotOptimize(parts);
+		box = parts.first;
+		h = h == 47 ? 0 : h + 1;
+		if (h == 0) {
+			box = Box(Point(-1, -1, -1), Point(1, 1, 1));
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+typedef void (*Mesh_benchmark)(benchmark::State&, MeshShape, size_t);
+
+void register_all(size_t max_triangles) {
+	struct Named {
+		char const* name;
+		Mesh_benchmark run;
+		bool every_size;  // the kernels cost the same at any size, they run on 10k meshes only
+	};
+	Named const benchmarks[] = {
+		{ "build", build, true },
+		{ "is_empty_point", is_empty_point, true },
+		{ "is_empty_points", is_empty_points, true },
+		{ "object_contains", object_contains, true },
+		{ "object_cross", object_cross, true },
+		{ "cross_triangle_triangle", cross_triangle_triangle, false },
+		{ "cross_triangle_triangles", cross_triangle_triangles, false }
+	};
+	MeshShape const shapes[] = { SPHERE_MESH, TORUS_MESH, PLATE_MESH, SOUP_MESH };
+	benchmark::RegisterBenchmark("divide_box", divide);
+	for (size_t count = 1000; count <= max_triangles && count <= 10000000; count *= 10) {
+		for (MeshShape shape : shapes) {
+			for (Named const& b : benchmarks) {
+				if (!b.every_size && count != 10000) {
+					continue;
+				}
+				std::string name = std::string(b.name) + '/' + shape_name(shape) + '/' + std::to_string(count);
+				Mesh_benchmark run = b.run;
+				auto* registered = benchmark::RegisterBenchmark(name.c_str(), [=](benchmark::State& state) {
+					run(state, shape, count);
+				});
+				registered->Unit(benchmark::kMicrosecond);
+				if (b.run == build && count >= 1000000) {
+					registered->Iterations(1);
+				}
+			}
+		}
+	}
+}
+}
+
+int main(int argc, char** argv) {
+	size_t max_triangles = 10000000;
+	bool has_out = false;
+	std::vector<char*> args;
+	for (int i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "--max_triangles=", 16) == 0) {
+			max_triangles = strtoull(argv[i] + 16, nullptr, 10);
+			continue;
+		}
+		has_out = has_out || strncmp(argv[i], "--benchmark_out=", 16) == 0;
+		args.push_back(argv[i]);
+	}
+	std::string out = "--benchmark_out=quadtree_benchmark.json";
+	std::string format = "--benchmark_out_format=json";
+	if (!has_out) {
+		args.push_back(&out[0]);
+		args.push_back(&format[0]);
+	}
+	int count = static_cast<int>(args.size());
+	benchmark::Initialize(&count, args.data());
+	if (benchmark::ReportUnrecognizedArguments(count, args.data())) {
+		return 1;
+	}
+	register_all(max_triangles);
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include "synthetic_mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+const float PI = 3.14159265358979f;
+
+// a grid of rows x columns quads over a surface, wrapping around in
+// columns and, if closed, in rows as well
+template <class F>
+void add_grid(std::vector<Triangle>& result, int rows, int columns, bool closed, F const& at) {
+	int last = closed ? rows : rows - 1;
+	for (int i = 0; i < last; i++) {
+		for (int j = 0; j < columns; j++) {
+			Point a = at(i, j);
+			Point b = at(i, (j + 1) % columns);
+			Point c = at((i + 1) % rows, (j + 1) % columns);
+			Point d = at((i + 1) % rows, j);
+			result.push_back(Triangle(a, b, c));
+			result.push_back(Triangle(a, c, d));
+		}
+	}
+}
+
+std::vector<Triangle> sphere(size_t count) {
+	// fans at the poles and two triangles per quad in between,
+	// 2 * columns * (rows - 1) triangles with columns = 2 * rows
+	int rows = std::max(2, static_cast<int>(sqrt(count / 4.0)));
+	int columns = 2 * rows;
+	auto at = [&](int i, int j) {
+		float theta = PI * (i + 1) / (rows + 1);
+		float phi = 2 * PI * j / columns;
+		return Point(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+	};
+	std::vector<Triangle> result;
+	add_grid(result, rows, columns, false, at);
+	Point top(0, 0, 1);
+	Point bottom(0, 0, -1);
+	for (int j = 0; j < columns; j++) {
+		result.push_back(Triangle(top, at(0, j), at(0, (j + 1) % columns)));
+		result.push_back(Triangle(bottom, at(rows - 1, (j + 1) % columns), at(rows - 1, j)));
+	}
+	return result;
+}
+
+std::vector<Triangle> torus(size_t count) {
+	// 2 * rows * columns triangles, the tube has half the columns of the ring
+	int rows = std::max(3, static_cast<int>(sqrt(count / 4.0)));
+	int columns = 2 * rows;
+	auto at = [&](int i, int j) {
+		float u = 2 * PI * j / columns;
+		float v = 2 * PI * i / rows;
+		float r = 0.7f + 0.25f * cos(v);
+		return Point(r * cos(u), r * sin(u), 0.25f * sin(v));
+	};
+	std::vector<Triangle> result;
+	add_grid(result, rows, columns, true, at);
+	return result;
+}
+
+std::vector<Triangle> plate(size_t count) {
+	// n x n quads on the top and the bottom and one row of n quads on every side
+	int n = std::max(1, static_cast<int>(sqrt(count / 4.0)));
+	float h = 0.125f;
+	auto xy = [&](int i) {
+		return -1 + 2.0f * i / n;
+	};
+	std::vector<Triangle> result;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			Point a(xy(i), xy(j), h);
+			Point b(xy(i + 1), xy(j), h);
+			Point c(xy(i + 1), xy(j + 1), h);
+			Point d(xy(i), xy(j + 1), h);
+			result.push_back(Triangle(a, b, c));
+			result.push_back(Triangle(a, c, d));
+			Point shift(0, 0, 2 * h);
+			result.push_back(Triangle(a - shift, c - shift, b - shift));
+			result.push_back(Triangle(a - shift, d - shift, c - shift));
+		}
+	}
+	// the rim, going around the plate counterclockwise seen from above
+	std::vector<Point> rim;
+	for (int i = 0; i < n; i++) {
+		rim.push_back(Point(xy(i), -1, 0));
+	}
+	for (int i = 0; i < n; i++) {
+		rim.push_back(Point(1, xy(i), 0));
+	}
+	for (int i = n; i > 0; i--) {
+		rim.push_back(Point(xy(i), 1, 0));
+	}
+	for (int i = n; i > 0; i--) {
+		rim.push_back(Point(-1, xy(i), 0));
+	}
+	Point up(0, 0, h);
+	for (size_t i = 0; i < rim.size(); i++) {
+		Point a = rim[i];
+		Point b = rim[(i + 1) % rim.size()];
+		result.push_back(Triangle(a - up, b - up, b + up));
+		result.push_back(Triangle(a - up, b + up, a + up));
+	}
+	return result;
+}
+
+std::vector<Triangle> soup(size_t count, uint32_t seed) {
+	// edges about the mean spacing of the centres, so neighbours often cross
+	std::mt19937 random(seed);
+	float size = 2 / cbrt(static_cast<float>(std::max<size_t>(count, 1)));
+	std::uniform_real_distribution<float> place(-1 + size, 1 - size);
+	std::uniform_real_distribution<float> offset(-size, size);
+	std::vector<Triangle> result;
+	result.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		Point centre(place(random), place(random), place(random));
+		Triangle t;
+		for (Point& p : t.points) {
+			p = centre + Point(offset(random), offset(random), offset(random));
+		}
+		result.push_back(t);
+	}
+	return result;
+}
+}
+
+char const* shape_name(MeshShape shape) {
+	switch (shape) {
+	case SPHERE_MESH:
+		return "sphere";
+	case TORUS_MESH:
+		return "torus";
+	case PLATE_MESH:
+		return "plate";
+	default:
+		return "soup";
+	}
+}
+
+std::vector<Triangle> make_mesh(MeshShape shape, size_t count, uint32_t seed) {
+	switch (shape) {
+	case SPHERE_MESH:
+		return sphere(count);
+	case TORUS_MESH:
+		return torus(count);
+	case PLATE_MESH:
+		return plate(count);
+	default:
+		return soup(count, seed);
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+
+enum MeshShape {
+	SPHERE_MESH,
+	TORUS_MESH,
+	PLATE_MESH,
+	SOUP_MESH
+};
+
+char const* shape_name(MeshShape shape);
+
+// About count triangles of the shape inside [-1, 1]^3. Sphere, torus and
+// plate are closed surfaces, the plate a flat box 0.25 thick. The soup is
+// count small triangles at random places with random orientations.
+std::vector<Triangle> make_mesh(MeshShape shape, size_t count, uint32_t seed = 1);
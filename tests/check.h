@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdio>
+
+// The tests are plain programs run by ctest. A failed CHECK prints where
+// it failed and the test returns failures() from main, 0 when all passed.
+inline int& failures() {
+	static int count = 0;
+	return count;
+}
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			failures()++; \
+		} \
+	} while (0)
@@ -0,0 +1,99 @@
+// Snapshots of a Flat_quadtree load back to the same answers, and a
+// snapshot whose node records point backwards is turned down.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "flat_quadtree.h"
+#include "physical_quadtree.h"
+
+namespace {
+	// where the header of a snapshot keeps the node count and the offset
+	// of the node records
+	const size_t NODE_COUNT_AT = 24;
+	const size_t NODES_OFFSET_AT = 40;
+
+	std::vector<char> read_file(std::string const& path) {
+		std::ifstream in(path.c_str(), std::ios::binary);
+		return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	void write_file(std::string const& path, std::vector<char> const& bytes) {
+		std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+		out.write(bytes.data(), bytes.size());
+	}
+
+	std::vector<Point> probes() {
+		std::vector<Point> result;
+		for (int i = 0; i < 1000; i++) {
+			result.push_back(Point(-1 + 2.0f * (i % 10) / 9, -1 + 2.0f * (i / 10 % 10) / 9, -1 + 2.0f * (i / 100) / 9));
+		}
+		return result;
+	}
+
+	// sets the right index of every node that has a right child to
+	// the index the callback gives
+	template <class F>
+	void damage(std::vector<char>& bytes, F right) {
+		uint64_t count;
+		uint64_t offset;
+		memcpy(&count, bytes.data() + NODE_COUNT_AT, sizeof(count));
+		memcpy(&offset, bytes.data() + NODES_OFFSET_AT, sizeof(offset));
+		for (uint64_t i = 0; i < count; i++) {
+			Flat_quadtree<Phy_node>::flat_node v;
+			memcpy(&v, bytes.data() + offset + i * sizeof(v), sizeof(v));
+			if (v.children & Flat_quadtree<Phy_node>::HAS_RIGHT) {
+				v.right = right(static_cast<uint32_t>(i));
+				memcpy(bytes.data() + offset + i * sizeof(v), &v, sizeof(v));
+			}
+		}
+	}
+}
+
+int main() {
+	std::vector<PObject> objects;
+	objects.push_back(PObject(Box(Point(-0.55f, -0.3f, -0.2f), Point(0.4f, 0.65f, 0.35f)), 1));
+	Build_settings settings;
+	settings.max_height = 9;
+	Quadtree<Phy_node> tree(objects, Box(Point(-1, -1, -1), Point(1, 1, 1)), settings);
+	Flat_quadtree<Phy_node> flat(tree);
+	std::vector<Point> points = probes();
+
+	std::string path = "flat_quadtree_test.snapshot";
+	std::string error;
+	CHECK(flat.save(path, &error));
+	std::unique_ptr<Flat_quadtree<Phy_node> > loaded = Flat_quadtree<Phy_node>::load(path, &error);
+	CHECK(loaded != nullptr);
+	if (loaded != nullptr) {
+		CHECK(loaded->size() == flat.size());
+		for (Point p : points) {
+			CHECK(loaded->is_empty_point(p) == tree.is_empty_point(p));
+			CHECK(loaded->is_full_point(p) == tree.is_full_point(p));
+		}
+	}
+	loaded.reset();
+
+	// a right index back to the root, and one to the node itself, would
+	// send the walk back up the tree, the last one out of the array
+	std::vector<char> bytes = read_file(path);
+	uint32_t (*damages[])(uint32_t) = {
+		[](uint32_t) { return 0u; },
+		[](uint32_t i) { return i; },
+		[](uint32_t) { return 0xffffffffu; }
+	};
+	for (auto right : damages) {
+		std::vector<char> damaged = bytes;
+		damage(damaged, right);
+		write_file(path, damaged);
+		error.clear();
+		loaded = Flat_quadtree<Phy_node>::load(path, &error);
+		CHECK(loaded == nullptr);
+		CHECK(!error.empty());
+	}
+	remove(path.c_str());
+	return failures();
+}
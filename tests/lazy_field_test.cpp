@@ -0,0 +1,43 @@
+// A lazy tree splits only the nodes the field evaluations open, and its
+// field is the field of the eager tree.
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "check.h"
+#include "field_line.h"
+#include "physical_quadtree.h"
+
+int main() {
+	std::vector<PObject> objects;
+	objects.push_back(PObject(Box(Point(-0.7f, -0.3f, -0.3f), Point(-0.3f, 0.3f, 0.2f)), 1));
+	objects.push_back(PObject(Box(Point(0.35f, -0.25f, -0.35f), Point(0.65f, 0.2f, 0.3f)), -1));
+	Scene scene(objects);
+	Box limit(Point(-1, -1, -1), Point(1, 1, 1));
+	Build_settings settings;
+	settings.max_height = 18;
+
+	Physical_quadtree::node_pool eager_nodes;
+	Physical_quadtree eager(scene, limit, 0.5f, settings, &eager_nodes);
+	settings.lazy = true;
+	Physical_quadtree::node_pool lazy_nodes;
+	Physical_quadtree lazy(scene, limit, 0.5f, settings, &lazy_nodes);
+
+	// one field line from the positive box to the negative one
+	Field_line line = Field_line_tracer(lazy).trace(Point(-0.25f, 0.05f, 0.45f));
+	CHECK(line.reason == HIT_OBJECT);
+	size_t split = lazy_nodes.size();
+	printf("%zu of %zu nodes made along a line of %zu points\n", split, eager_nodes.size(), line.points.size());
+	CHECK(split * 5 < eager_nodes.size());
+
+	std::vector<Point> lazy_field;
+	std::vector<Point> eager_field;
+	lazy.field_at(line.points, lazy_field);
+	eager.field_at(line.points, eager_field);
+	for (size_t i = 0; i < line.points.size(); i++) {
+		Point d = lazy_field[i] - eager_field[i];
+		CHECK(sqrtf(dot_product(d, d)) <= 0.01f * sqrtf(dot_product(eager_field[i], eager_field[i])));
+	}
+	// evaluating the line again splits nothing more
+	CHECK(lazy_nodes.size() == split);
+	return failures();
+}